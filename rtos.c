@@ -67,23 +67,16 @@ typedef void (*_fn)();
 
 void updateMemoryBlocks(uint8_t task, uint32_t srd, int8_t type);
 void freeMemoryBlocks(uint32_t srd);
-
-// semaphore
-#define MAX_SEMAPHORES 5
-#define MAX_QUEUE_SIZE 5
-typedef struct _semaphore
-{
-    uint16_t count;
-    uint16_t queueSize;
-    uint32_t processQueue[MAX_QUEUE_SIZE]; // store task index here
-    char name[16]; // store task index here
-} semaphore;
-
-semaphore semaphores[MAX_SEMAPHORES];
-#define keyPressed 1
-#define keyReleased 2
-#define flashReq 3
-#define resource 4
+void stringCopy(char *dst, const char *src);
+uint8_t stringAppend(char *dst, uint8_t i, const char *src);
+void idle();
+uint32_t currentTick();
+void refreshPriority(uint8_t task);
+void mlfqDemote(uint8_t task);
+int rtosScheduler();
+void semRemoveWaiter(uint8_t task);
+void mutexRemoveWaiter(uint8_t task);
+void eventRemoveWaiter(uint8_t task);
 
 // task
 #define STATE_INVALID    0 // no task
@@ -91,33 +84,255 @@ semaphore semaphores[MAX_SEMAPHORES];
 #define STATE_READY      2 // has run, can resume at any time
 #define STATE_DELAYED    3 // has run, but now awaiting timer
 #define STATE_BLOCKED    4 // has run, but now blocked by semaphore
+#define STATE_SUSPENDED  5 // LO criticality task shed while in HI mode
 
 #define MAX_PRIORITIES 8
-#define MAX_TASKS 12       // maximum number of valid tasks
+#define DEFAULT_QUANTUM 1
+#define DEFAULT_TICKETS 100
+#define MAX_TICKETS 1000
+#define STRIDE1 (1 << 16)  // stride of a task holding a single ticket
+// Task stacks take whole 1 KiB MPU subregions of the 24 KiB above the kernel, so 24 tasks
+// is the most SRAM can hold. Indexes and PIDs allow up to 64 should stacks get smaller
+#define MAX_TASKS 24       // size of the TCB pool
+#define PID_SLOT_BITS 6    // PID = generation << PID_SLOT_BITS | pool slot
+#define PID_SLOT(pid) ((pid) & ((1 << PID_SLOT_BITS) - 1))
+#define NO_PID 0           // generations start at 1, so no task has PID 0
+#define NAME_BUCKETS 16
 uint8_t taskCurrent = 0;   // index of last dispatched task //HINT: taskCurrent <-- sched \n fn = task[taskCurrent].pfn \n *fn(); setPSP and setTMPL
-uint8_t taskCount = 0;     // total number of valid tasks
-bool priority = true;
+uint8_t taskCount = 0;     // TCB slots handed out from the pool
+uint8_t tcbFree = 0;       // free list of TCB slots, linked through next
+uint8_t nameHead[NAME_BUCKETS]; // name hash chains, linked through nameNext
+// scheduling policies
+#define SCHED_RR   0
+#define SCHED_PRIO 1
+#define SCHED_EDF  2 // earliest deadline first, tasks without a deadline by priority
+#define SCHED_MLFQ 3 // multi-level feedback queue over the priority levels
+#define SCHED_STRIDE 4 // proportional share among the tasks of the top ready priority
+#define SCHED_CLASS 5  // real-time class by priority over a fair class by vruntime
+// scheduling classes
+#define CLASS_RT   0
+#define CLASS_FAIR 1
+uint8_t schedMode = SCHED_PRIO;
 bool preemption = true;
+uint32_t agingTicks = 0;   // ticks a ready task waits before gaining a level, 0 = no aging
+uint32_t agingNext = 0;    // tick of the next aging pass
+#define AGING_CEILING 1    // aging never raises a task above this priority, level 0 stays reserved
+#define MLFQ_BOOST_TICKS 500
+uint32_t mlfqNext = 0;     // tick of the next MLFQ boost to the top level
 uint32_t timeInitial = 0;
 uint8_t wr_index = 0;
 uint32_t totalTime[2];
 
+// ready queue
+#define NO_TASK 0xFF
+#define PRIORITY_BIT(p) (0x80000000 >> (p)) // CLZ of the bitmap yields the top priority
+uint32_t readyBitmap = 0;                   // one bit per priority with a ready task
+uint8_t readyHead[MAX_PRIORITIES];          // circular ready list per priority
+uint8_t rrHead = NO_TASK;                   // circular list of all ready tasks (RR)
+uint8_t sleepHead = NO_TASK;                // delta list of delayed tasks, nearest first
+uint8_t edfHead = NO_TASK;                  // ready tasks with a deadline, earliest first
+uint32_t switchesAvoided = 0;               // PendSVs that kept the running task
+uint32_t switchCycles = 0;                  // WTIMER0 cycles spent in timed context switches
+uint32_t switchesTimed = 0;
+uint32_t switchCyclesMax = 0;
+uint32_t rtBitmap = 0;                      // one bit per priority with a ready RT class task
+uint8_t rtReady[MAX_PRIORITIES];            // ready RT class tasks per priority
+uint8_t fairHeap[MAX_TASKS];                // ready fair class tasks, min-heap on vruntime
+uint8_t fairCount = 0;
+
+// semaphore
+#define SEM_SLOT_BITS 5    // handle = generation << SEM_SLOT_BITS | table slot
+#define SEM_SLOT(sem) ((sem) & ((1 << SEM_SLOT_BITS) - 1))
+#define MAX_SEMAPHORES (1 << SEM_SLOT_BITS)
+#define NO_SEM 0           // generations start at 1, so no semaphore has handle 0
+#define NO_SEMAPHORE 0xFF
+// 8 shared bytes per slot plus the demo handles must fit the 1 KiB .shared region, which
+// also keeps slots below NO_SEMAPHORE and the ipcs rows within a uint8_t
+#if SEM_SLOT_BITS > 6
+#error "SEM_SLOT_BITS above 6 overflows the .shared region"
+#endif
+typedef struct _semaphore
+{
+    uint32_t handle;                    // last handle given out for this slot
+    bool live;
+    uint8_t liveNext;                   // circular list of live semaphores, free list while unused
+    uint8_t livePrev;
+    uint32_t waitBitmap;                // one bit per priority with a waiting task
+    uint8_t waitHead[MAX_PRIORITIES];   // circular FIFO of waiters per priority, linked through the TCBs
+    char name[16]; // store task index here
+} semaphore;
+
+semaphore semaphores[MAX_SEMAPHORES];
+uint8_t semFree = 0;                    // free table slots, linked through liveNext
+uint8_t semLiveHead = NO_SEMAPHORE;     // oldest live semaphore
+// Counts live in the shared subregion so wait() and post() can update them from user mode
+// with LDREX/STREX. SEM_WAITERS is set by the kernel while the queue is not empty, which
+// sends every post() to the kernel and makes a racing STREX fail. The handle beside the
+// count sends calls with a deleted handle to the kernel, which rejects them
+#define SEM_WAITERS 0x80000000
+#define SEM_COUNT   0x7FFFFFFF
+typedef struct _semaphoreWord
+{
+    uint32_t count;
+    uint32_t handle;                    // handle of the live semaphore, NO_SEM while free
+} semaphoreWord;
+#pragma DATA_SECTION(semaphoreWords, ".shared")
+semaphoreWord semaphoreWords[MAX_SEMAPHORES];
+// Handles of the semaphores created in main(), shared so that tasks can read them
+#pragma DATA_SECTION(flashReq, ".shared")
+#pragma DATA_SECTION(pingPong, ".shared")
+#pragma DATA_SECTION(pongGo, ".shared")
+uint32_t flashReq, pingPong, pongGo;
+
+// system timer
+#define CYCLES_PER_TICK 40000               // 1 ms at 40 MHz
+#define CYCLES_PER_US 40
+#define MAX_TICK_STRIDE 400                 // SysTick reload is 24 bits (~419 ms)
+#define MIN_PERIOD_CYCLES 400               // shortest SysTick period we program
+bool tickless = false;
+uint32_t tickCount = 0;                     // monotonic ticks since startup
+uint32_t tickStride = 1;                    // ticks covered by the running SysTick period
+uint32_t periodLoad = CYCLES_PER_TICK - 1;  // value the running period was loaded with
+uint32_t periodOffset = 0;                  // cycles of the period elapsed before that load
+uint32_t idleTicks = 0;                     // ticks spent in the idle task
+uint8_t taskIdle = 0;
+
 struct _tcb
 {
     uint8_t state;                 // see STATE_ values above
-    void *pid;                     // used to uniquely identify thread
+    void *pid;                     // entry point, used to uniquely identify thread
+    uint16_t handle;               // compact PID shown by ps and taken by the kill, pidof, ... commands
+    uint8_t nameNext;              // next task in the same name hash bucket
     void *spInit;                  // original top of stack
     void *sp;                      // current stack pointer
     int8_t priorityInit;           // Original priority
     int8_t priority;               // 0=highest to 15=lowest
-    uint32_t ticks;                // ticks until sleep complete
+    uint32_t ticks;                // ticks after the previous sleeper (delta list)
     uint32_t srd;                  // MPU subregion disable bits (one per 1 KiB)
     char name[16];                 // name of task used in ps command
     void *semaphore;               // pointer to the semaphore that is blocking the thread
-    int8_t hasSemaphore;           // Pointer to the semaphore process is using
+    uint8_t waitNext;              // next waiter of the same priority on that semaphore, or on the event group
+    uint8_t waitPrev;              // previous waiter of the same priority on that semaphore, or on the event group
+    int8_t eventGroup;             // event group the task waits on, -1 if none
+    uint8_t eventOptions;          // EVENT_ALL and EVENT_CLEAR of that wait
+    uint32_t eventMask;            // bits the task waits for
+    bool timedWait;                // blocked with a timeout, also in the sleep delta list
+    int8_t mutex;                  // mutex the task is blocked on, -1 if none
+    uint8_t mutexesHeld;           // one bit per mutex owned by the task
     uint32_t time[2];                 // Time spent in process
+    uint8_t next;                  // next task in the ready list of its priority
+    uint8_t prev;                  // previous task in the ready list of its priority
+    uint8_t rrNext;                // next task in the round-robin ready list
+    uint8_t rrPrev;                // previous task in the round-robin ready list
+    uint8_t sleepNext;             // next task in the sleep queue
+    uint8_t sleepPrev;             // previous task in the sleep queue
+    uint32_t period;               // release period in ticks (0 = aperiodic)
+    uint32_t deadline;             // relative deadline in ticks (0 = none)
+    uint32_t absDeadline;          // tick by which the current job must finish
+    int32_t lateness;              // finish tick - absDeadline of the last job
+    uint32_t release;              // release tick of the current job
+    uint32_t releases;             // jobs released
+    uint32_t completions;          // jobs completed
+    uint32_t misses;               // jobs completed after their deadline
+    uint8_t edfNext;               // next task in the EDF ready list
+    uint8_t edfPrev;               // previous task in the EDF ready list
+    uint16_t quantum;              // ticks the task runs before same-priority tasks get a turn
+    uint16_t sliceLeft;            // ticks left of the current slice
+    uint32_t budget;               // CPU cycles allowed per budget period (0 = unlimited)
+    uint32_t budgetPeriod;         // replenishment period in ticks
+    uint32_t budgetUsed;           // cycles charged since the last replenishment
+    uint32_t replenish;            // tick of the next replenishment
+    uint32_t throttles;            // times the task was suspended for exhausting its budget
+    uint8_t boost;                 // levels gained by aging while waiting to run
+    uint32_t readySince;           // tick the task last became ready, ran or aged
+    int8_t mlfqLevel;              // priority level under MLFQ scheduling
+    uint32_t mlfqUsed;             // cycles run at that level, kept across yields
+    uint16_t tickets;              // CPU share relative to the other tasks of its priority
+    uint32_t stride;               // STRIDE1 / tickets, pass advance per tick of CPU time
+    uint32_t pass;                 // virtual time, the lowest pass runs next under stride scheduling
+    uint8_t schedClass;            // CLASS_RT or CLASS_FAIR
+    uint8_t heapIndex;             // position in fairHeap while ready
+    uint32_t vruntime;             // CPU cycles weighted by tickets, the lowest runs next in the fair class
+    bool slotWait;                 // blocked in waitSlot() until its cyclic executive slot
+    uint8_t criticality;           // CRIT_LO or CRIT_HI
+    uint32_t loBudget;             // cycles per job trusted in LO mode (0 = unlimited)
+    uint32_t hiBudget;             // cycles per job trusted in HI mode (0 = unlimited)
+    uint32_t jobCycles;            // cycles charged to the current job
+    uint8_t resumeState;           // state to restore when a suspended task is resumed
 } tcb[MAX_TASKS];
 
+// cyclic executive: a major frame of MINOR_FRAMES minor frames, each slot releases one
+// task at a fixed tick of the major frame, ahead of whatever the scheduler would pick
+#define MINOR_FRAMES 4
+#define MINOR_FRAME_TICKS 250
+#define MAJOR_FRAME_TICKS (MINOR_FRAMES * MINOR_FRAME_TICKS)
+#define MAX_SLOTS 8
+typedef struct _slot
+{
+    uint16_t tick;                 // offset into the major frame
+    uint8_t task;
+} slot;
+slot slots[MAX_SLOTS];             // sorted by tick
+uint8_t slotCount = 0;
+uint8_t slotNext = 0;              // next slot to release
+uint32_t frameStart = 0;           // tick the current major frame started
+bool cyclic = false;
+uint8_t slotTask = NO_TASK;        // released task that runs before the scheduler's choice
+uint32_t slotOverruns = 0;         // releases of tasks still busy with their previous slot
+
+// task blocked in getcUart0() until the UART0 receive or receive time-out interrupt
+uint8_t inputTask = NO_TASK;
+
+// mixed criticality: a HI task overrunning its LO budget sheds the LO tasks until only idle is ready
+#define CRIT_LO 0
+#define CRIT_HI 1
+#define CRIT_STAT_MODE 0
+#define CRIT_STAT_SWITCHES 1
+#define CRIT_STAT_HI_TIME 2
+#define CRIT_STAT_OVERRUNS 3
+#define CRIT_STAT_COUNT 4
+uint8_t critMode = CRIT_LO;
+uint32_t hiModeSwitches = 0;       // LO to HI transitions
+uint32_t hiModeTicks = 0;          // ticks spent in completed HI mode intervals
+uint32_t hiModeStart = 0;
+uint32_t hiOverruns = 0;           // HI jobs that exceeded their HI budget
+
+// mutex with priority inheritance or an immediate priority ceiling
+#define MAX_MUTEXES 2
+#define NO_OWNER -1
+#define NO_CEILING MAX_PRIORITIES
+typedef struct _mutex
+{
+    int8_t owner;                          // task holding the mutex
+    int8_t ceiling;                        // priority the owner runs at, NO_CEILING for inheritance only
+    uint8_t queueSize;
+    uint8_t processQueue[MAX_TASKS];       // waiting tasks in arrival order
+    char name[16];
+} mutex;
+
+mutex mutexes[MAX_MUTEXES];
+#define resource 0
+#define yellowLed 1
+#define NO_MUTEX -1
+
+// event group, 32 flags that tasks wait on for any or all bits of a mask
+#define MAX_EVENT_GROUPS 2
+#define NO_EVENTS -1
+#define EVENT_ANY   0
+#define EVENT_ALL   1  // all bits of the mask must be set
+#define EVENT_CLEAR 2  // the bits of the mask are cleared when the wait ends
+typedef struct _eventGroup
+{
+    uint32_t flags;
+    uint8_t waitHead;                      // circular list of waiters in arrival order, linked through the TCBs
+    char name[16];
+} eventGroup;
+
+eventGroup eventGroups[MAX_EVENT_GROUPS];
+#define keyEvents 0
+#define KEY_PRESSED  1 // a press waits to be debounced
+#define KEY_RELEASED 2 // the buttons were released, readKeys may look for the next press
+
 struct _memoryBlocks
 {
     int8_t ownership;
@@ -125,8 +340,17 @@ struct _memoryBlocks
 }memoryBlocks[32];
 
 uint32_t *heapBotPtr = 0x20002000;
+// kernel statistics reported by ps
+#define STAT_SWITCHES_AVOIDED 0
+#define STAT_IDLE_RESIDENCY 1
+#define STAT_SLOT_OVERRUNS 2
+#define STAT_SWITCH_CYCLES 3
+#define STAT_SWITCH_CYCLES_MAX 4
+#define STAT_COUNT 5
+
 #define SRAMTOPADDR 0x20008000
 #define SRAMBOTADDR 0x20000000
+#define SHARED_SRD 0x80  // last 1 KiB of the kernel region, readable and writable by every task
 #define ALLOCATION_EMPTY 0
 #define ALLOCATION_STACK 1
 #define ALLOCATION_HEAP 2
@@ -146,8 +370,40 @@ uint32_t *heapBotPtr = 0x20002000;
 #define SVC_PRIORITY  12
 #define SVC_REBOOT  13
 #define SVC_PS  14
+#define SVC_STATS  15
+#define SVC_TICKLESS  16
 #define SVC_STOP  17
 #define SVC_RESTART  18
+#define SVC_SLEEP_UNTIL  19
+#define SVC_WAIT_PERIOD  20
+#define SVC_TICK_COUNT  21
+#define SVC_LOCK  22
+#define SVC_UNLOCK  23
+#define SVC_SETQUANTUM  24
+#define SVC_SETBUDGET  25
+#define SVC_AGING  26
+#define SVC_SETSHARE  27
+#define SVC_SETCLASS  28
+#define SVC_WAIT_SLOT  29
+#define SVC_CYCLIC  30
+#define SVC_SETCRIT  31
+#define SVC_CRIT  32
+#define SVC_GETPID  33
+#define SVC_BENCH  34
+#define SVC_WAIT_TIMEOUT  35
+#define SVC_LOCK_TIMEOUT  36
+#define SVC_SEM_CREATE  37
+#define SVC_SEM_DELETE  38
+#define SVC_WAIT_EVENTS  39
+#define SVC_SET_EVENTS  40
+#define SVC_CLEAR_EVENTS  41
+#define SVC_INPUT_WAIT  42
+
+// timed waits
+#define WAIT_FOREVER 0xFFFFFFFF
+#define WAIT_OK      0
+#define WAIT_TIMEOUT 1
+#define WAIT_INVALID 2     // the semaphore or mutex does not exist, or the semaphore was deleted while waiting
 
 
 
@@ -210,7 +466,7 @@ void setupSramAccess(void)
 
 void setSramAccessWindow(uint32_t mask)
 {
-//    mask |= 0x1F;
+    mask |= SHARED_SRD;
     // SRAM region 0
     NVIC_MPU_BASE_R = 0x20000013;
     NVIC_MPU_ATTR_R = 0x11060019 | ((mask << 8) & 0xFF00);
@@ -264,54 +520,871 @@ void initRtos()
     {
         tcb[i].state = STATE_INVALID;
         tcb[i].pid = 0;
+        tcb[i].handle = i; // Generation 0, the first start makes it 1
+        tcb[i].next = i + 1 < MAX_TASKS ? i + 1 : NO_TASK;
     }
+    tcbFree = 0;
+    for(i = 0; i < NAME_BUCKETS; i++)
+        nameHead[i] = NO_TASK;
     for(i = 0; i < 32; i++)
     {
         memoryBlocks[i].ownership = -1;
         memoryBlocks[i].allocationType = ALLOCATION_EMPTY;
     }
+    // empty ready queue
+    readyBitmap = 0;
+    rrHead = NO_TASK;
+    sleepHead = NO_TASK;
+    edfHead = NO_TASK;
+    for(i = 0; i < MAX_PRIORITIES; i++)
+        readyHead[i] = NO_TASK;
+    for(i = 0; i < MAX_MUTEXES; i++)
+        mutexes[i].owner = NO_OWNER;
+    for(i = 0; i < MAX_EVENT_GROUPS; i++)
+        eventGroups[i].waitHead = NO_TASK;
+    for(i = 0; i < MAX_SEMAPHORES; i++)
+    {
+        semaphores[i].handle = i;
+        semaphores[i].live = false;
+        semaphores[i].liveNext = i + 1 < MAX_SEMAPHORES ? i + 1 : NO_SEMAPHORE;
+        semaphoreWords[i].handle = NO_SEM;
+    }
+    semFree = 0;
+    semLiveHead = NO_SEMAPHORE;
 }
 
-// REQUIRED: Implement prioritization to 8 levels
-int rtosScheduler()
+// Case-insensitive like stringCompare(), so pidof and run accept any case
+uint8_t nameHash(const char name[])
 {
-    bool ok;
-    static uint8_t task = 0xFF;
-    static uint8_t priorityTaskCurrent[MAX_PRIORITIES] = {0};
-    ok = false;
-    if(!priority) {
-        while (!ok) {
-            task++;
-            if (task >= MAX_TASKS)
-                task = 0;
-            ok = (tcb[task].state == STATE_READY || tcb[task].state == STATE_UNRUN);
-        }
+    uint8_t hash = 0;
+    char c;
+    while((c = *name++) != 0)
+        hash = hash * 31 + ((c >= 'A' && c <= 'Z') ? c + 32 : c);
+    return hash % NAME_BUCKETS;
+}
+
+// Slot of the task called name, NO_TASK if there is none
+uint8_t findTask(const char name[])
+{
+    uint8_t task = nameHead[nameHash(name)];
+    while(task != NO_TASK && !stringCompare(name, tcb[task].name))
+        task = tcb[task].nameNext;
+    return task;
+}
+
+// Slot of the task with this PID, NO_TASK if the PID is stale or was never handed out
+uint8_t taskFromPid(uint32_t pid)
+{
+    uint8_t task = PID_SLOT(pid);
+    if(pid == NO_PID || task >= MAX_TASKS || tcb[task].handle != pid)
+        return NO_TASK;
+    return task;
+}
+
+// A new generation for each start, so PIDs of stopped tasks stay invalid after a restart
+void newPid(uint8_t task)
+{
+    tcb[task].handle += 1 << PID_SLOT_BITS;
+    if(tcb[task].handle >> PID_SLOT_BITS == 0)
+        tcb[task].handle += 1 << PID_SLOT_BITS;
+}
+
+bool isReady(uint8_t state)
+{
+    return state == STATE_READY || state == STATE_UNRUN;
+}
+
+// Inserts task into the EDF list behind all jobs due no later than it
+void edfInsert(uint8_t task)
+{
+    uint8_t prev = NO_TASK;
+    uint8_t next = edfHead;
+    while(next != NO_TASK && (int32_t)(tcb[next].absDeadline - tcb[task].absDeadline) <= 0)
+    {
+        prev = next;
+        next = tcb[next].edfNext;
+    }
+    tcb[task].edfPrev = prev;
+    tcb[task].edfNext = next;
+    if(next != NO_TASK)
+        tcb[next].edfPrev = task;
+    if(prev != NO_TASK)
+        tcb[prev].edfNext = task;
+    else
+        edfHead = task;
+}
+
+void edfRemove(uint8_t task)
+{
+    uint8_t prev = tcb[task].edfPrev;
+    uint8_t next = tcb[task].edfNext;
+    if(next != NO_TASK)
+        tcb[next].edfPrev = prev;
+    if(prev != NO_TASK)
+        tcb[prev].edfNext = next;
+    else
+        edfHead = next;
+}
+
+// The idle task stays out of the heap and runs when both classes are empty
+bool inFairHeap(uint8_t task)
+{
+    return tcb[task].schedClass == CLASS_FAIR && task != taskIdle;
+}
+
+void heapPlace(uint8_t i, uint8_t task)
+{
+    fairHeap[i] = task;
+    tcb[task].heapIndex = i;
+}
+
+void heapSiftUp(uint8_t i)
+{
+    uint8_t task = fairHeap[i];
+    uint8_t parent;
+    while(i > 0)
+    {
+        parent = (i - 1) / 2;
+        if((int32_t)(tcb[task].vruntime - tcb[fairHeap[parent]].vruntime) >= 0)
+            break;
+        heapPlace(i, fairHeap[parent]);
+        i = parent;
+    }
+    heapPlace(i, task);
+}
+
+void heapSiftDown(uint8_t i)
+{
+    uint8_t task = fairHeap[i];
+    uint8_t child;
+    while((child = 2 * i + 1) < fairCount)
+    {
+        if(child + 1 < fairCount && (int32_t)(tcb[fairHeap[child + 1]].vruntime - tcb[fairHeap[child]].vruntime) < 0)
+            child++;
+        if((int32_t)(tcb[fairHeap[child]].vruntime - tcb[task].vruntime) >= 0)
+            break;
+        heapPlace(i, fairHeap[child]);
+        i = child;
+    }
+    heapPlace(i, task);
+}
+
+void heapInsert(uint8_t task)
+{
+    heapPlace(fairCount, task);
+    heapSiftUp(fairCount++);
+}
+
+void heapRemove(uint8_t task)
+{
+    uint8_t i = tcb[task].heapIndex;
+    uint8_t last = fairHeap[--fairCount];
+    if(i != fairCount)
+    {
+        // The last entry fills the hole and moves whichever way its vruntime requires
+        heapPlace(i, last);
+        heapSiftUp(i);
+        heapSiftDown(tcb[last].heapIndex);
+    }
+}
+
+// Appends task to the tail of its priority list and of the RR list with a full slice
+void readyInsert(uint8_t task)
+{
+    uint8_t prio = tcb[task].priority;
+    uint8_t head = readyHead[prio];
+    tcb[task].sliceLeft = tcb[task].quantum;
+    if(head == NO_TASK)
+    {
+        tcb[task].next = task;
+        tcb[task].prev = task;
+        readyHead[prio] = task;
+        readyBitmap |= PRIORITY_BIT(prio);
+    }
+    else
+    {
+        tcb[task].next = head;
+        tcb[task].prev = tcb[head].prev;
+        tcb[tcb[head].prev].next = task;
+        tcb[head].prev = task;
+    }
+    if(rrHead == NO_TASK)
+    {
+        tcb[task].rrNext = task;
+        tcb[task].rrPrev = task;
+        rrHead = task;
+    }
+    else
+    {
+        tcb[task].rrNext = rrHead;
+        tcb[task].rrPrev = tcb[rrHead].rrPrev;
+        tcb[tcb[rrHead].rrPrev].rrNext = task;
+        tcb[rrHead].rrPrev = task;
+    }
+    if(tcb[task].deadline)
+        edfInsert(task);
+    if(tcb[task].schedClass == CLASS_RT)
+    {
+        if(rtReady[prio]++ == 0)
+            rtBitmap |= PRIORITY_BIT(prio);
+    }
+    else if(inFairHeap(task))
+        heapInsert(task);
+}
+
+// Unlinks task from its priority list and from the RR list
+void readyRemove(uint8_t task)
+{
+    uint8_t prio = tcb[task].priority;
+    if(tcb[task].next == task)
+    {
+        readyHead[prio] = NO_TASK;
+        readyBitmap &= ~PRIORITY_BIT(prio);
+    }
+    else
+    {
+        tcb[tcb[task].prev].next = tcb[task].next;
+        tcb[tcb[task].next].prev = tcb[task].prev;
+        if(readyHead[prio] == task)
+            readyHead[prio] = tcb[task].next;
+    }
+    if(tcb[task].rrNext == task)
+        rrHead = NO_TASK;
+    else
+    {
+        tcb[tcb[task].rrPrev].rrNext = tcb[task].rrNext;
+        tcb[tcb[task].rrNext].rrPrev = tcb[task].rrPrev;
+        if(rrHead == task)
+            rrHead = tcb[task].rrNext;
+    }
+    if(tcb[task].deadline)
+        edfRemove(task);
+    if(tcb[task].schedClass == CLASS_RT)
+    {
+        if(--rtReady[prio] == 0)
+            rtBitmap &= ~PRIORITY_BIT(prio);
+    }
+    else if(inFairHeap(task))
+        heapRemove(task);
+}
+
+// Starts a job released at tick
+void releaseJob(uint8_t task, uint32_t tick)
+{
+    tcb[task].release = tick;
+    tcb[task].absDeadline = tick + tcb[task].deadline;
+    tcb[task].releases++;
+    tcb[task].jobCycles = 0;
+}
+
+// Ends the current job and checks it against its deadline
+void completeJob(uint8_t task)
+{
+    tcb[task].completions++;
+    if(tcb[task].deadline)
+    {
+        tcb[task].lateness = currentTick() - tcb[task].absDeadline;
+        if(tcb[task].lateness > 0)
+            tcb[task].misses++;
+    }
+}
+
+// Ready task of priority prio with the lowest pass, the list order breaks ties
+uint8_t strideSelect(uint8_t prio)
+{
+    uint8_t best = readyHead[prio];
+    uint8_t task = tcb[best].next;
+    while(task != readyHead[prio])
+    {
+        if((int32_t)(tcb[task].pass - tcb[best].pass) < 0)
+            best = task;
+        task = tcb[task].next;
+    }
+    return best;
+}
+
+// RT class task of the highest ready RT priority, else the fair task with the least vruntime
+uint8_t classSelect()
+{
+    uint8_t task;
+    if(rtBitmap)
+    {
+        task = readyHead[countLeadingZeros(rtBitmap)];
+        while(tcb[task].schedClass != CLASS_RT)
+            task = tcb[task].next;
+        return task;
+    }
+    if(fairCount)
+        return fairHeap[0];
+    return taskIdle;
+}
+
+// A fair task that becomes ready starts at the least vruntime of the others, for the same reason as strideJoin()
+void fairJoin(uint8_t task)
+{
+    if(inFairHeap(task) && fairCount && (int32_t)(tcb[task].vruntime - tcb[fairHeap[0]].vruntime) < 0)
+        tcb[task].vruntime = tcb[fairHeap[0]].vruntime;
+}
+
+// A task joining its ready list starts no earlier than the lowest pass there, so
+// time spent blocked is not banked as credit against the tasks that kept running
+void strideJoin(uint8_t task)
+{
+    uint8_t prio = tcb[task].priority;
+    uint8_t low;
+    if(readyBitmap & PRIORITY_BIT(prio))
+    {
+        low = strideSelect(prio);
+        if((int32_t)(tcb[task].pass - tcb[low].pass) < 0)
+            tcb[task].pass = tcb[low].pass;
+    }
+}
+
+// LO tasks holding a mutex keep running so HI tasks never wait on a suspended owner
+bool isSheddable(uint8_t task)
+{
+    return tcb[task].criticality == CRIT_LO && task != taskIdle && !tcb[task].mutexesHeld;
+}
+
+// All state changes go through here so the ready queue stays in sync
+// For aperiodic tasks becoming ready releases a job and leaving ready completes it,
+// periodic tasks release on their period grid through waitNextPeriod()
+void setTaskState(uint8_t task, uint8_t state)
+{
+    bool wasReady = isReady(tcb[task].state);
+    // LO tasks that become ready in HI mode wait for the switch back
+    if(!wasReady && isReady(state) && critMode == CRIT_HI && isSheddable(task))
+    {
+        tcb[task].resumeState = state;
+        state = STATE_SUSPENDED;
+    }
+    tcb[task].state = state;
+    if(wasReady && !isReady(state))
+    {
+        readyRemove(task);
+        if(!tcb[task].period && state != STATE_INVALID)
+            completeJob(task);
+    }
+    else if(!wasReady && isReady(state))
+    {
+        tcb[task].readySince = currentTick();
+        strideJoin(task);
+        fairJoin(task);
+        if(!tcb[task].period || state == STATE_UNRUN)
+            releaseJob(task, currentTick());
+        readyInsert(task);
+    }
+}
+
+// Moves a ready task behind the others of its priority and refills its slice
+void rotateTask(uint8_t task)
+{
+    tcb[task].sliceLeft = tcb[task].quantum;
+    if(readyHead[tcb[task].priority] == task)
+        readyHead[tcb[task].priority] = tcb[task].next;
+    if(rrHead == task)
+        rrHead = tcb[task].rrNext;
+}
+
+// True when other ready tasks wait for the running task's slice to end
+bool sliceActive()
+{
+    if(schedMode == SCHED_EDF && edfHead != NO_TASK)
+        return false;
+    if(schedMode == SCHED_RR)
+        return tcb[taskCurrent].rrNext != taskCurrent;
+    if(schedMode == SCHED_CLASS && inFairHeap(taskCurrent))
+        return fairCount > 1;
+    return tcb[taskCurrent].next != taskCurrent;
+}
+
+// Appends task to the waiters of its priority on sem
+void semQueueInsert(semaphore *sem, uint8_t task)
+{
+    uint8_t prio = tcb[task].priority;
+    uint8_t head = sem->waitHead[prio];
+    if(!(sem->waitBitmap & PRIORITY_BIT(prio)))
+    {
+        tcb[task].waitNext = task;
+        tcb[task].waitPrev = task;
+        sem->waitHead[prio] = task;
+        sem->waitBitmap |= PRIORITY_BIT(prio);
+    }
+    else
+    {
+        tcb[task].waitNext = head;
+        tcb[task].waitPrev = tcb[head].waitPrev;
+        tcb[tcb[head].waitPrev].waitNext = task;
+        tcb[head].waitPrev = task;
+    }
+}
+
+// Unlinks a waiter from sem
+void semQueueRemove(semaphore *sem, uint8_t task)
+{
+    uint8_t prio = tcb[task].priority;
+    if(tcb[task].waitNext == task)
+        sem->waitBitmap &= ~PRIORITY_BIT(prio);
+    else
+    {
+        tcb[tcb[task].waitPrev].waitNext = tcb[task].waitNext;
+        tcb[tcb[task].waitNext].waitPrev = tcb[task].waitPrev;
+        if(sem->waitHead[prio] == task)
+            sem->waitHead[prio] = tcb[task].waitNext;
+    }
+}
+
+// Highest-priority waiter on sem, first come first served within a priority
+uint8_t semQueueFirst(semaphore *sem)
+{
+    if(sem->waitBitmap == 0)
+        return NO_TASK;
+    return sem->waitHead[countLeadingZeros(sem->waitBitmap)];
+}
+
+// Moves a ready task to the list of its new priority
+void setTaskPriority(uint8_t task, int8_t priority)
+{
+    if(isReady(tcb[task].state))
+    {
+        readyRemove(task);
+        tcb[task].priority = priority;
+        strideJoin(task); // a pass from the old level means nothing at the new one
+        readyInsert(task);
+    }
+    else if(tcb[task].semaphore)
+    {
+        // A waiter joins the tail of its new priority
+        semQueueRemove(tcb[task].semaphore, task);
+        tcb[task].priority = priority;
+        semQueueInsert(tcb[task].semaphore, task);
+    }
+    else
+        tcb[task].priority = priority;
+}
+
+// Pends a switch only when a ready task outranks the running one
+void checkPreemption()
+{
+    bool outranked;
+    if(!preemption)
+        return;
+    if(schedMode == SCHED_EDF && edfHead != NO_TASK)
+        outranked = edfHead != taskCurrent;
+    else if(schedMode == SCHED_CLASS || schedMode == SCHED_STRIDE)
+        outranked = rtosScheduler() != taskCurrent; // An RT task outranks any fair one whatever its priority
+    else
+        outranked = schedMode != SCHED_RR && countLeadingZeros(readyBitmap) < tcb[taskCurrent].priority;
+    if(outranked)
+        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+}
+
+// True when the scheduler would select a task other than the running one
+bool rescheduleNeeded()
+{
+    if(slotTask != NO_TASK && isReady(tcb[slotTask].state))
+        return slotTask != taskCurrent;
+    if(!isReady(tcb[taskCurrent].state))
+        return true;
+    if(schedMode == SCHED_EDF && edfHead != NO_TASK)
+        return edfHead != taskCurrent;
+    if(schedMode == SCHED_RR)
+        return rrHead != taskCurrent;
+    if(schedMode == SCHED_CLASS)
+        return classSelect() != taskCurrent;
+    if(countLeadingZeros(readyBitmap) < tcb[taskCurrent].priority)
+        return true;
+    if(schedMode == SCHED_STRIDE)
+        return strideSelect(tcb[taskCurrent].priority) != taskCurrent;
+    return readyHead[tcb[taskCurrent].priority] != taskCurrent;
+}
+
+// Inserts task into the delta list so it wakes ticks after the period start
+// Equal deadlines wake in the order they went to sleep
+void sleepInsert(uint8_t task, uint32_t ticks)
+{
+    uint8_t prev = NO_TASK;
+    uint8_t next = sleepHead;
+    while(next != NO_TASK && tcb[next].ticks <= ticks)
+    {
+        ticks -= tcb[next].ticks;
+        prev = next;
+        next = tcb[next].sleepNext;
+    }
+    tcb[task].ticks = ticks;
+    tcb[task].sleepPrev = prev;
+    tcb[task].sleepNext = next;
+    if(next != NO_TASK)
+    {
+        tcb[next].ticks -= ticks;
+        tcb[next].sleepPrev = task;
+    }
+    if(prev != NO_TASK)
+        tcb[prev].sleepNext = task;
+    else
+        sleepHead = task;
+}
+
+// Unlinks a sleeper, its successor inherits the remaining delta
+void sleepRemove(uint8_t task)
+{
+    uint8_t prev = tcb[task].sleepPrev;
+    uint8_t next = tcb[task].sleepNext;
+    if(next != NO_TASK)
+    {
+        tcb[next].ticks += tcb[task].ticks;
+        tcb[next].sleepPrev = prev;
     }
+    if(prev != NO_TASK)
+        tcb[prev].sleepNext = next;
     else
+        sleepHead = next;
+}
+
+// Takes a task woken by a post or an unlock off the delta list before its timeout fires
+void cancelTimeout(uint8_t task)
+{
+    if(tcb[task].timedWait)
+    {
+        sleepRemove(task);
+        tcb[task].timedWait = false;
+    }
+}
+
+// Sets the value the blocking call of a switched out task returns. A task that blocks is
+// switched out before anything can wake it, as PendSV runs ahead of SysTick
+void setTaskResult(uint8_t task, uint32_t value)
+{
+    uint32_t *frame = (uint32_t *)tcb[task].sp + 9; // R4 - R11 and EXC_RETURN
+    if(!(frame[-1] & 0x10))
+        frame += 16;                                // S16 - S31 of a task using the FPU
+    frame[OFFSET_R0] = value;
+}
+
+// Cycles elapsed since the running SysTick period started
+uint32_t periodElapsed()
+{
+    return periodOffset + periodLoad - NVIC_ST_CURRENT_R;
+}
+
+// Ticks since startup including those of the running period
+uint32_t currentTick()
+{
+    return tickCount + periodElapsed() / CYCLES_PER_TICK;
+}
+
+// Sleep list entry for ticks from now, which the list counts from the period start
+// Clamped so a wait of nearly WAIT_FOREVER does not wrap into a short one
+uint32_t wakeTicks(uint32_t ticks)
+{
+    uint32_t elapsed = periodElapsed() / CYCLES_PER_TICK;
+    if(ticks > WAIT_FOREVER - 1 - elapsed)
+        ticks = WAIT_FOREVER - 1 - elapsed;
+    return ticks + elapsed;
+}
+
+// Suspends the ready LO tasks
+void enterHiMode()
+{
+    uint8_t i;
+    critMode = CRIT_HI;
+    hiModeSwitches++;
+    hiModeStart = tickCount;
+    for(i = 0; i < taskCount; i++)
     {
-        // Saves task current as last used in priority buffer
-        priorityTaskCurrent[tcb[taskCurrent].priority] = taskCurrent;
-        int8_t maxPriority = 7;
-        // Finds lowest priority for all available tasks
-        for(task = 0; task < MAX_TASKS; task++)
+        if(isReady(tcb[i].state) && isSheddable(i))
         {
-            if(tcb[task].priority < maxPriority && (tcb[task].state == STATE_READY || tcb[task].state == STATE_UNRUN))
-                            maxPriority = tcb[task].priority;
+            tcb[i].resumeState = tcb[i].state;
+            setTaskState(i, STATE_SUSPENDED);
         }
+    }
+    NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+}
 
-        task = priorityTaskCurrent[maxPriority];
-        while(!ok)
+// Resumes the LO tasks once the HI work has drained
+void leaveHiMode()
+{
+    uint8_t i;
+    critMode = CRIT_LO;
+    hiModeTicks += tickCount - hiModeStart;
+    for(i = 0; i < taskCount; i++)
+    {
+        if(tcb[i].state == STATE_SUSPENDED)
+            setTaskState(i, tcb[i].resumeState);
+    }
+}
+
+// Charges the running task for the cycles since it was dispatched or last charged
+// The budget is replenished lazily, so idle reservations cost nothing per tick
+void chargeCpuTime()
+{
+    uint32_t now = WTIMER0_TAV_R;
+    uint32_t cycles = now - timeInitial;
+    timeInitial = now;
+    tcb[taskCurrent].time[wr_index] += cycles;
+    tcb[taskCurrent].jobCycles += cycles;
+    if(tcb[taskCurrent].criticality == CRIT_HI)
+    {
+        if(critMode == CRIT_LO && tcb[taskCurrent].loBudget && tcb[taskCurrent].jobCycles > tcb[taskCurrent].loBudget)
+            enterHiMode();
+        else if(critMode == CRIT_HI && tcb[taskCurrent].hiBudget && tcb[taskCurrent].jobCycles > tcb[taskCurrent].hiBudget
+                && tcb[taskCurrent].jobCycles - cycles <= tcb[taskCurrent].hiBudget)
+            hiOverruns++;
+    }
+    // MLFQ allotment, a quantum of CPU time per level however often the task yields
+    if(schedMode == SCHED_MLFQ)
+    {
+        tcb[taskCurrent].mlfqUsed += cycles;
+        if(tcb[taskCurrent].mlfqUsed >= tcb[taskCurrent].quantum * CYCLES_PER_TICK)
+            mlfqDemote(taskCurrent);
+    }
+    tcb[taskCurrent].pass += ((uint64_t)tcb[taskCurrent].stride * cycles) / CYCLES_PER_TICK;
+    tcb[taskCurrent].vruntime += ((uint64_t)cycles * DEFAULT_TICKETS) / tcb[taskCurrent].tickets;
+    if(isReady(tcb[taskCurrent].state) && inFairHeap(taskCurrent))
+        heapSiftDown(tcb[taskCurrent].heapIndex);
+    if(tcb[taskCurrent].budget)
+    {
+        if((int32_t)(tickCount - tcb[taskCurrent].replenish) >= 0)
+        {
+            tcb[taskCurrent].budgetUsed = 0;
+            tcb[taskCurrent].replenish = tickCount + tcb[taskCurrent].budgetPeriod;
+        }
+        tcb[taskCurrent].budgetUsed += cycles;
+    }
+}
+
+// Suspends the running task until its next replenishment once its budget is spent
+void enforceBudget()
+{
+    if(tcb[taskCurrent].budget && tcb[taskCurrent].budgetUsed >= tcb[taskCurrent].budget
+            && tcb[taskCurrent].state == STATE_READY)
+    {
+        tcb[taskCurrent].throttles++;
+        setTaskState(taskCurrent, STATE_DELAYED);
+        sleepInsert(taskCurrent, tcb[taskCurrent].replenish - tickCount);
+        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+    }
+}
+
+// Reserves budgetUs of CPU time per period ticks for a task, a budget of 0 removes the reservation
+bool setBudget(uint32_t pid, uint32_t budgetUs, uint32_t period)
+{
+    uint8_t i = taskFromPid(pid);
+    bool ok = i != NO_TASK && tcb[i].state != STATE_INVALID && i != taskIdle
+            && (budgetUs == 0 || (period > 0 && budgetUs / 1000 < period && budgetUs <= UINT32_MAX / CYCLES_PER_US));
+    if(ok)
+    {
+        tcb[i].budget = budgetUs * CYCLES_PER_US;
+        tcb[i].budgetPeriod = period;
+        tcb[i].budgetUsed = 0;
+        tcb[i].replenish = tickCount + period;
+    }
+    return ok;
+}
+
+// Raises every task left ready but not running for agingTicks by one level, up to AGING_CEILING
+// Runs once per aging interval, so a task waits between one and two intervals per level
+void ageTasks()
+{
+    uint8_t i;
+    agingNext = tickCount + agingTicks;
+    for(i = 0; i < taskCount; i++)
+    {
+        if(i != taskCurrent && i != taskIdle && isReady(tcb[i].state)
+                && tickCount - tcb[i].readySince >= agingTicks && tcb[i].priority > AGING_CEILING)
+        {
+            tcb[i].boost++;
+            tcb[i].readySince = tickCount;
+            refreshPriority(i);
+        }
+    }
+}
+
+// Drops the aging boost of a task that got its turn
+void resetAging(uint8_t task)
+{
+    tcb[task].readySince = tickCount;
+    if(tcb[task].boost)
+    {
+        tcb[task].boost = 0;
+        refreshPriority(task);
+    }
+}
+
+// MLFQ: a task that used up its allotment drops a level, idle keeps the bottom one
+void mlfqDemote(uint8_t task)
+{
+    tcb[task].mlfqUsed = 0;
+    if(schedMode == SCHED_MLFQ && task != taskIdle && tcb[task].mlfqLevel < MAX_PRIORITIES - 2)
+    {
+        tcb[task].mlfqLevel++;
+        refreshPriority(task);
+    }
+}
+
+// MLFQ: a task that blocks (sleep, wait, lock, UART input) climbs a level, a yield does not
+void mlfqPromote(uint8_t task)
+{
+    tcb[task].mlfqUsed = 0;
+    if(schedMode == SCHED_MLFQ && task != taskIdle && tcb[task].mlfqLevel > 0)
+    {
+        tcb[task].mlfqLevel--;
+        refreshPriority(task);
+    }
+}
+
+// Moves every task back to the top level so demoted tasks cannot starve
+void mlfqBoostAll()
+{
+    uint8_t i;
+    mlfqNext = tickCount + MLFQ_BOOST_TICKS;
+    for(i = 0; i < taskCount; i++)
+    {
+        if(i != taskIdle)
+            tcb[i].mlfqLevel = 0;
+        tcb[i].mlfqUsed = 0;
+        refreshPriority(i);
+    }
+}
+
+// Releases the tasks whose slots are due, called from the SysTick ISR so the release
+// tick is exact and the released task is dispatched by the PendSV that follows
+void releaseSlots()
+{
+    uint8_t task;
+    while(cyclic && slotCount && (int32_t)(tickCount - (frameStart + slots[slotNext].tick)) >= 0)
+    {
+        task = slots[slotNext].task;
+        if(tcb[task].slotWait)
+        {
+            tcb[task].slotWait = false;
+            setTaskState(task, STATE_READY);
+            slotTask = task;
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        }
+        else
+            slotOverruns++;
+        if(++slotNext == slotCount)
+        {
+            slotNext = 0;
+            frameStart += MAJOR_FRAME_TICKS;
+        }
+    }
+}
+
+// Credits elapsed ticks and wakes the sleepers that are due
+void advanceTicks(uint32_t ticks)
+{
+    uint8_t task;
+    tickCount += ticks;
+    if(taskCurrent == taskIdle)
+        idleTicks += ticks;
+    // Only the head of the delta list is touched unless sleepers are due
+    while(sleepHead != NO_TASK && tcb[sleepHead].ticks <= ticks)
+    {
+        task = sleepHead;
+        sleepRemove(task);
+        if(tcb[task].timedWait)
         {
-            task++;
-            if (task >= MAX_TASKS)
-                task = 0;
-            ok = (tcb[task].state == STATE_READY || tcb[task].state == STATE_UNRUN) && tcb[task].priority == maxPriority;
+            // The timeout came first, the task leaves the queue it waits on
+            tcb[task].timedWait = false;
+            if(tcb[task].eventGroup != NO_EVENTS)
+            {
+                eventRemoveWaiter(task);
+                setTaskResult(task, 0); // No bits
+            }
+            else
+            {
+                if(tcb[task].mutex != NO_MUTEX)
+                    mutexRemoveWaiter(task);
+                else
+                    semRemoveWaiter(task);
+                setTaskResult(task, WAIT_TIMEOUT);
+            }
         }
+        setTaskState(task, STATE_READY);
     }
+    if(sleepHead != NO_TASK)
+        tcb[sleepHead].ticks -= ticks;
+}
+
+// Ticks from the start of the running SysTick period to the next kernel event
+uint32_t ticksToNextEvent()
+{
+    uint32_t ticks = MAX_TICK_STRIDE;
+    if(preemption && rescheduleNeeded())
+        return 1;
+    if(preemption && sliceActive() && tcb[taskCurrent].sliceLeft < ticks)
+        ticks = tcb[taskCurrent].sliceLeft;
+    if(preemption && sliceActive() && (schedMode == SCHED_STRIDE || schedMode == SCHED_CLASS))
+        ticks = 1; // Passes and vruntimes are compared every tick
+    if(tcb[taskCurrent].budget)
+        ticks = 1; // Budget is enforced on tick boundaries
+    if(agingTicks && agingNext - tickCount < ticks)
+        ticks = agingNext - tickCount ? agingNext - tickCount : 1;
+    if(schedMode == SCHED_MLFQ && mlfqNext - tickCount < ticks)
+        ticks = mlfqNext - tickCount ? mlfqNext - tickCount : 1;
+    if(cyclic && slotCount && frameStart + slots[slotNext].tick - tickCount < ticks)
+        ticks = frameStart + slots[slotNext].tick - tickCount ? frameStart + slots[slotNext].tick - tickCount : 1;
+    if(sleepHead != NO_TASK && tcb[sleepHead].ticks < ticks)
+        ticks = tcb[sleepHead].ticks;
+    return ticks;
+}
+
+// Stretches or shrinks the running SysTick period to end at the next event
+// In tick mode this restores the 1 ms period
+void updateTickStride()
+{
+    uint32_t stride = 1;
+    uint32_t elapsed;
+    if(tickless)
+        stride = ticksToNextEvent();
+    if(stride == tickStride)
+        return;
+    elapsed = periodElapsed();
+    if(NVIC_INT_CTRL_R & NVIC_INT_CTRL_PENDSTSET)
+        return; // Period already ended, systickIsr will account it
+    if(stride * CYCLES_PER_TICK < elapsed + MIN_PERIOD_CYCLES)
+        stride = (elapsed + MIN_PERIOD_CYCLES) / CYCLES_PER_TICK + 1;
+    if(stride == tickStride)
+        return;
+    // Re-read right before the restart, the cycles since the first read would be lost
+    elapsed = periodElapsed();
+    if(NVIC_INT_CTRL_R & NVIC_INT_CTRL_PENDSTSET)
+        return; // Ended meanwhile
+    tickStride = stride;
+    periodOffset = elapsed;
+    periodLoad = stride * CYCLES_PER_TICK - elapsed - 1;
+    NVIC_ST_RELOAD_R = periodLoad;
+    NVIC_ST_CURRENT_R = 0;                  // Counter reloads periodLoad on the next clock
+    NVIC_ST_RELOAD_R = CYCLES_PER_TICK - 1; // Later periods are a single tick
+}
+
+// REQUIRED: Implement prioritization to 8 levels
+// Every mode picks the head of a ready list, so the choice is O(1)
+// Lists rotate when a slice expires or the task yields, see rotateTask()
+int rtosScheduler()
+{
+    uint8_t task;
+    if(slotTask != NO_TASK && isReady(tcb[slotTask].state))
+        task = slotTask; // Time-triggered release, no search
+    else if(schedMode == SCHED_EDF && edfHead != NO_TASK)
+        task = edfHead;
+    else if(schedMode == SCHED_RR)
+        task = rrHead;
+    else if(schedMode == SCHED_STRIDE)
+        task = strideSelect(countLeadingZeros(readyBitmap));
+    else if(schedMode == SCHED_CLASS)
+        task = classSelect();
+    else
+        task = readyHead[countLeadingZeros(readyBitmap)]; // Highest ready priority
     return task;
 }
 
-bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes)
+// period and deadline are in ticks, a deadline of 0 leaves the task to fixed priority
+// quantum is the time slice in ticks, 0 selects DEFAULT_QUANTUM
+// schedClass is CLASS_RT or CLASS_FAIR and only matters under SCHED_CLASS
+bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes, uint32_t period, uint32_t deadline, uint16_t quantum, uint8_t schedClass)
 {
     bool ok = false;
     uint8_t i = 0;
@@ -324,24 +1397,50 @@ bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackByt
     // HINT: cast void * sp to uint8_t * to allow arithmetic
     // HINT: malloc returns low end of the stack while the function needs the top of the stack
     // add task if room in task list
-    if (taskCount < MAX_TASKS)
+    if (tcbFree != NO_TASK)
     {
         // make sure fn not already in list (prevent reentrancy)
         while (!found && (i < MAX_TASKS))
         {
             found = (tcb[i++].pid ==  fn);
         }
+        found |= findTask(name) != NO_TASK; // Names must be unique for pidof and run
         if (!found)
         {
-            // find first available tcb record
-            i = 0;
-            while (tcb[i].state != STATE_INVALID) {i++;}
-            tcb[i].state = STATE_UNRUN;
+            // take a record from the pool, slots of stopped tasks stay theirs for run
+            i = tcbFree;
+            tcbFree = tcb[i].next;
             tcb[i].pid = fn;
+            newPid(i);
             tcb[i].sp = allocaFromHeap(stackBytes);   // HINT: ACTIVE SP (0 if function is inactive)
             tcb[i].spInit = tcb[i].sp;                      // HINT: Top of the stack (backup copy of SP should be result of malloc)
             tcb[i].priorityInit = priority;
             tcb[i].priority = priority;
+            tcb[i].quantum = quantum ? quantum : DEFAULT_QUANTUM;
+            tcb[i].budget = 0;
+            tcb[i].throttles = 0;
+            tcb[i].boost = 0;
+            tcb[i].mlfqLevel = (fn == idle) ? MAX_PRIORITIES - 1 : 0;
+            tcb[i].mlfqUsed = 0;
+            tcb[i].tickets = DEFAULT_TICKETS;
+            tcb[i].stride = STRIDE1 / DEFAULT_TICKETS;
+            tcb[i].pass = 0;
+            tcb[i].schedClass = schedClass;
+            tcb[i].vruntime = 0;
+            tcb[i].slotWait = false;
+            tcb[i].criticality = CRIT_LO;
+            tcb[i].loBudget = 0;
+            tcb[i].hiBudget = 0;
+            tcb[i].timedWait = false;
+            tcb[i].mutex = NO_MUTEX;
+            tcb[i].mutexesHeld = 0;
+            tcb[i].eventGroup = NO_EVENTS;
+            tcb[i].period = period;
+            tcb[i].deadline = deadline;
+            tcb[i].lateness = 0;
+            tcb[i].releases = 0;
+            tcb[i].completions = 0;
+            tcb[i].misses = 0;
             tcb[i].srd = getSramSRD(tcb[i].sp, stackBytes); // Or'ed with 0x1F to stack in SRAM
             // Update global memoryBlock array
             updateMemoryBlocks(i, tcb[i].srd, ALLOCATION_STACK);
@@ -351,6 +1450,11 @@ bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackByt
                 j++;
             }
             tcb[i].name[j] = '\0';
+            tcb[i].nameNext = nameHead[nameHash(name)];
+            nameHead[nameHash(name)] = i;
+            if(fn == idle)
+                taskIdle = i;
+            setTaskState(i, STATE_UNRUN);
             // increment task count
             taskCount++;
             ok = true;
@@ -360,6 +1464,17 @@ bool createThread(_fn fn, const char name[], uint8_t priority, uint32_t stackByt
     return ok;
 }
 
+// Periodic task released every period ticks, each job due deadline ticks after its release
+// The task calls waitNextPeriod() at the end of each job
+bool createPeriodicThread(_fn fn, const char name[], uint8_t priority, uint32_t stackBytes, uint32_t period, uint32_t deadline)
+{
+    if(period == 0)
+        return false;
+    if(deadline == 0)
+        deadline = period; // Implicit deadline
+    return createThread(fn, name, priority, stackBytes, period, deadline, DEFAULT_QUANTUM, CLASS_RT);
+}
+
 // REQUIRED: modify this function to restart a thread
 bool restartThread(char *func)
 {
@@ -369,31 +1484,416 @@ bool restartThread(char *func)
 // REQUIRED: modify this function to stop a thread
 // REQUIRED: remove any pending semaphore waiting
 // NOTE: see notes in class for strategies on whether stack is freed or not
-bool stopThread(_fn fn)
+bool stopThread(uint32_t pid)
+{
+    __asm(" SVC #17");
+}
+
+// REQUIRED: modify this function to set a thread priority
+void setThreadPriority(uint32_t pid, uint8_t priority)
+{
+    __asm(" SVC #7");
+}
+
+// Sets the time slice of a thread in ticks, 1 to UINT16_MAX
+bool setThreadQuantum(uint32_t pid, uint32_t quantum)
+{
+    __asm(" SVC #24");
+}
+
+// Moves a thread to CLASS_RT or CLASS_FAIR
+bool setThreadClass(uint32_t pid, uint8_t schedClass)
+{
+    __asm(" SVC #28");
+}
+
+// Sets the CPU share of a thread among the threads of its priority
+bool setThreadShare(uint32_t pid, uint16_t tickets)
+{
+    __asm(" SVC #27");
+}
+
+// Limits a thread to budgetUs of CPU time every period ticks
+bool setThreadBudget(uint32_t pid, uint32_t budgetUs, uint32_t period)
+{
+    __asm(" SVC #25");
+}
+
+// Takes a slot from the semaphore table, returns its handle or NO_SEM when the table is full
+uint32_t createSemaphore(const char name[], uint32_t count)
+{
+    uint8_t s = semFree;
+    uint8_t j = 0;
+    if(s == NO_SEMAPHORE)
+        return NO_SEM;
+    semFree = semaphores[s].liveNext;
+    semaphores[s].handle += 1 << SEM_SLOT_BITS;
+    if(semaphores[s].handle >> SEM_SLOT_BITS == 0)
+        semaphores[s].handle += 1 << SEM_SLOT_BITS;
+    semaphores[s].live = true;
+    semaphores[s].waitBitmap = 0;
+    while(name[j] != 0 && j < sizeof(semaphores[s].name) - 1) // Strcpy
+    {
+        semaphores[s].name[j] = name[j];
+        j++;
+    }
+    semaphores[s].name[j] = 0;
+    // Appended at the tail, ipcs lists the semaphores in creation order
+    if(semLiveHead == NO_SEMAPHORE)
+    {
+        semaphores[s].liveNext = s;
+        semaphores[s].livePrev = s;
+        semLiveHead = s;
+    }
+    else
+    {
+        semaphores[s].liveNext = semLiveHead;
+        semaphores[s].livePrev = semaphores[semLiveHead].livePrev;
+        semaphores[semaphores[semLiveHead].livePrev].liveNext = s;
+        semaphores[semLiveHead].livePrev = s;
+    }
+    semaphoreWords[s].count = count & SEM_COUNT;
+    semaphoreWords[s].handle = semaphores[s].handle;
+    return semaphores[s].handle;
+}
+
+// Slot of the live semaphore with this handle, NO_SEMAPHORE if it was deleted or never created
+uint8_t semFromHandle(uint32_t sem)
+{
+    uint8_t s = SEM_SLOT(sem);
+    if(sem == NO_SEM || !semaphores[s].live || semaphores[s].handle != sem)
+        return NO_SEMAPHORE;
+    return s;
+}
+
+// Adds a slot releasing task name at offset ticks into minor frame frame, the task must loop on waitSlot()
+// Slots must fall on distinct ticks
+bool createSlot(const char name[], uint8_t frame, uint16_t offset)
+{
+    bool ok = slotCount < MAX_SLOTS && frame < MINOR_FRAMES && offset < MINOR_FRAME_TICKS;
+    uint16_t tick = frame * MINOR_FRAME_TICKS + offset;
+    uint8_t i, task = findTask(name);
+    ok &= task != NO_TASK;
+    for(i = 0; ok && i < slotCount; i++)
+        ok = slots[i].tick != tick;
+    if(ok)
+    {
+        i = slotCount++;
+        while(i > 0 && slots[i - 1].tick > tick)
+        {
+            slots[i] = slots[i - 1];
+            i--;
+        }
+        slots[i].tick = tick;
+        slots[i].task = task;
+    }
+    return ok;
+}
+
+// Tags a task with its criticality and its per-job budgets in microseconds, 0 means unlimited
+bool setCriticality(uint32_t pid, uint8_t criticality, uint32_t loBudgetUs, uint32_t hiBudgetUs)
+{
+    uint8_t i = taskFromPid(pid);
+    bool ok = i != NO_TASK && tcb[i].state != STATE_INVALID && i != taskIdle
+            && (criticality == CRIT_LO || criticality == CRIT_HI);
+    if(ok)
+    {
+        tcb[i].criticality = criticality;
+        tcb[i].loBudget = loBudgetUs * CYCLES_PER_US;
+        tcb[i].hiBudget = hiBudgetUs * CYCLES_PER_US;
+    }
+    return ok;
+}
+
+// PID of the task called name for setup code in main(), NO_PID if there is none
+uint32_t taskPid(const char name[])
+{
+    uint8_t task = findTask(name);
+    return task == NO_TASK ? NO_PID : tcb[task].handle;
+}
+
+bool createMutex(uint8_t mutex, const char name[])
+{
+    bool ok = (mutex < MAX_MUTEXES);
+    if(ok)
+    {
+        mutexes[mutex].owner = NO_OWNER;
+        mutexes[mutex].ceiling = NO_CEILING;
+        mutexes[mutex].queueSize = 0;
+        stringCopy(mutexes[mutex].name, name);
+    }
+    return ok;
+}
+
+// Taking this mutex raises the caller to ceiling at once, which must be at least the
+// priority of every task using it. Under priority scheduling the holder can then never be
+// blocked by another user, so lock() never waits and ceiling mutexes cannot deadlock
+bool createCeilingMutex(uint8_t mutex, const char name[], uint8_t ceiling)
+{
+    bool ok = createMutex(mutex, name) && ceiling < MAX_PRIORITIES;
+    if(ok)
+        mutexes[mutex].ceiling = ceiling;
+    return ok;
+}
+
+bool createEventGroup(uint8_t group, uint32_t flags, const char name[])
+{
+    bool ok = (group < MAX_EVENT_GROUPS);
+    if(ok)
+    {
+        eventGroups[group].flags = flags;
+        eventGroups[group].waitHead = NO_TASK;
+        stringCopy(eventGroups[group].name, name);
+    }
+    return ok;
+}
+
+bool eventsMatch(uint32_t flags, uint32_t mask, uint8_t options)
+{
+    if(options & EVENT_ALL)
+        return (flags & mask) == mask;
+    return (flags & mask) != 0;
+}
+
+// Appends task to the waiters of the group
+void eventQueueInsert(uint8_t group, uint8_t task)
+{
+    uint8_t head = eventGroups[group].waitHead;
+    if(head == NO_TASK)
+    {
+        tcb[task].waitNext = task;
+        tcb[task].waitPrev = task;
+        eventGroups[group].waitHead = task;
+    }
+    else
+    {
+        tcb[task].waitNext = head;
+        tcb[task].waitPrev = tcb[head].waitPrev;
+        tcb[tcb[head].waitPrev].waitNext = task;
+        tcb[head].waitPrev = task;
+    }
+    tcb[task].eventGroup = group;
+}
+
+// Takes a blocked task off the waiters of the event group it waits on
+void eventRemoveWaiter(uint8_t task)
+{
+    eventGroup *grp = &eventGroups[tcb[task].eventGroup];
+    if(tcb[task].waitNext == task)
+        grp->waitHead = NO_TASK;
+    else
+    {
+        tcb[tcb[task].waitPrev].waitNext = tcb[task].waitNext;
+        tcb[tcb[task].waitNext].waitPrev = tcb[task].waitPrev;
+        if(grp->waitHead == task)
+            grp->waitHead = tcb[task].waitNext;
+    }
+    tcb[task].eventGroup = NO_EVENTS;
+    cancelTimeout(task);
+}
+
+// Sets bits of the group and wakes every waiter they satisfy in one pass, ISRs may call it
+// directly. Bits the woken waiters clear go after the pass, so they all see the same flags
+void setEvents(uint8_t group, uint32_t bits)
+{
+    eventGroup *grp = &eventGroups[group];
+    uint32_t clear = 0;
+    uint8_t task, next, last;
+    bool woke = false;
+    grp->flags |= bits;
+    if(grp->waitHead == NO_TASK)
+        return;
+    task = grp->waitHead;
+    last = tcb[task].waitPrev;
+    while(true)
+    {
+        next = tcb[task].waitNext;
+        if(eventsMatch(grp->flags, tcb[task].eventMask, tcb[task].eventOptions))
+        {
+            if(tcb[task].eventOptions & EVENT_CLEAR)
+                clear |= tcb[task].eventMask;
+            eventRemoveWaiter(task);
+            setTaskResult(task, grp->flags & tcb[task].eventMask);
+            setTaskState(task, STATE_READY);
+            woke = true;
+        }
+        if(task == last)
+            break;
+        task = next;
+    }
+    grp->flags &= ~clear;
+    if(woke)
+        checkPreemption();
+}
+
+// ipcs lists the live semaphores followed by the named mutexes and event groups. Below
+// IPCS_MUTEXES a row is the slot of a live semaphore plus one, row 0 starts the listing
+#define IPCS_MUTEXES (MAX_SEMAPHORES + 1)
+#define IPCS_EVENTS (IPCS_MUTEXES + MAX_MUTEXES)
+#define IPCS_ROWS (IPCS_EVENTS + MAX_EVENT_GROUPS)
+bool ipcsRowUsed(uint8_t row)
+{
+    if(row < IPCS_MUTEXES)
+        return semaphores[row - 1].live;
+    if(row < IPCS_EVENTS)
+        return mutexes[row - IPCS_MUTEXES].name[0] != 0;
+    return eventGroups[row - IPCS_EVENTS].name[0] != 0;
+}
+
+// Row after a semaphore row, the mutexes follow the newest semaphore
+uint8_t ipcsNextSemaphore(uint8_t s)
+{
+    if(semaphores[s].liveNext == semLiveHead)
+        return IPCS_MUTEXES;
+    return semaphores[s].liveNext + 1;
+}
+
+// Effective priority is the base priority raised to the ceilings of the mutexes the task
+// holds and to the highest waiter on them, a change is passed on along the chain of owners
+void refreshPriority(uint8_t task)
+{
+    int8_t base = schedMode == SCHED_MLFQ ? tcb[task].mlfqLevel : tcb[task].priorityInit;
+    int8_t prio = base - tcb[task].boost;
+    uint8_t m, j, waiter;
+    if(prio < AGING_CEILING)
+        prio = base < AGING_CEILING ? base : AGING_CEILING;
+    for(m = 0; m < MAX_MUTEXES; m++)
+    {
+        if(tcb[task].mutexesHeld & (1 << m))
+        {
+            if(mutexes[m].ceiling < prio)
+                prio = mutexes[m].ceiling;
+            for(j = 0; j < mutexes[m].queueSize; j++)
+            {
+                waiter = mutexes[m].processQueue[j];
+                if(tcb[waiter].priority < prio)
+                    prio = tcb[waiter].priority;
+            }
+        }
+    }
+    if(prio != tcb[task].priority)
+    {
+        setTaskPriority(task, prio);
+        if(tcb[task].mutex != NO_MUTEX)
+            refreshPriority(mutexes[tcb[task].mutex].owner);
+    }
+}
+
+// Passes a mutex to its highest-priority waiter, first come first served within a priority
+void mutexHandOff(uint8_t m)
+{
+    uint8_t j, task;
+    uint8_t best = 0;
+    mutexes[m].owner = NO_OWNER;
+    if(mutexes[m].queueSize == 0)
+        return;
+    for(j = 1; j < mutexes[m].queueSize; j++)
+    {
+        if(tcb[mutexes[m].processQueue[j]].priority < tcb[mutexes[m].processQueue[best]].priority)
+            best = j;
+    }
+    task = mutexes[m].processQueue[best];
+    mutexes[m].queueSize--;
+    for(j = best; j < mutexes[m].queueSize; j++)
+        mutexes[m].processQueue[j] = mutexes[m].processQueue[j + 1];
+    mutexes[m].owner = task;
+    tcb[task].mutex = NO_MUTEX;
+    cancelTimeout(task);
+    tcb[task].mutexesHeld |= 1 << m;
+    setTaskState(task, STATE_READY);
+    refreshPriority(task); // Inherits from the remaining waiters
+}
+
+// Releases a mutex held by task and drops the priority it inherited through it
+void mutexRelease(uint8_t task, uint8_t m)
+{
+    tcb[task].mutexesHeld &= ~(1 << m);
+    mutexHandOff(m);
+    refreshPriority(task);
+}
+
+void mutexReleaseAll(uint8_t task)
+{
+    uint8_t m;
+    for(m = 0; m < MAX_MUTEXES; m++)
+    {
+        if(tcb[task].mutexesHeld & (1 << m))
+            mutexRelease(task, m);
+    }
+}
+
+// Takes a blocked task off the queue of the mutex it waits on
+void mutexRemoveWaiter(uint8_t task)
+{
+    uint8_t m = tcb[task].mutex;
+    uint8_t j = 0;
+    while(mutexes[m].processQueue[j] != task)
+        j++;
+    mutexes[m].queueSize--;
+    for(; j < mutexes[m].queueSize; j++)
+        mutexes[m].processQueue[j] = mutexes[m].processQueue[j + 1];
+    tcb[task].mutex = NO_MUTEX;
+    cancelTimeout(task);
+    refreshPriority(mutexes[m].owner); // Owner may lose what it inherited from task
+}
+
+// Hands the semaphore to its first waiter or raises the count, returns true if a task woke
+bool semRelease(uint8_t s)
 {
-    __asm(" SVC #17");
+    uint8_t task = semQueueFirst(&semaphores[s]);
+    if(task == NO_TASK)
+    {
+        if((semaphoreWords[s].count & SEM_COUNT) != SEM_COUNT) // A full count would carry into SEM_WAITERS
+            semaphoreWords[s].count++;
+        return false;
+    }
+    semQueueRemove(&semaphores[s], task);
+    if(semaphores[s].waitBitmap == 0)
+        semaphoreWords[s].count &= ~SEM_WAITERS;
+    tcb[task].semaphore = 0;
+    cancelTimeout(task);
+    setTaskState(task, STATE_READY);
+    return true;
 }
 
-// REQUIRED: modify this function to set a thread priority
-void setThreadPriority(_fn fn, uint8_t priority)
+// Takes a blocked task off the queue of the semaphore it waits on
+void semRemoveWaiter(uint8_t task)
 {
-    __asm(" SVC #7");
+    semaphore *sem = (semaphore *)tcb[task].semaphore;
+    semQueueRemove(sem, task);
+    if(sem->waitBitmap == 0)
+        semaphoreWords[sem - semaphores].count &= ~SEM_WAITERS;
+    tcb[task].semaphore = 0;
+    cancelTimeout(task);
 }
 
-bool createSemaphore(uint8_t semaphore, uint8_t count, const char name[])
+// Frees a semaphore slot, its waiters wake with WAIT_INVALID and its handle stops working
+bool deleteSemaphore(uint32_t sem)
 {
-    uint8_t j = 0;
-    bool ok = (semaphore < MAX_SEMAPHORES);
+    uint8_t s = semFromHandle(sem);
+    uint8_t task;
+    if(s == NO_SEMAPHORE)
+        return false;
+    while((task = semQueueFirst(&semaphores[s])) != NO_TASK)
     {
-        semaphores[semaphore].count = count;
-        while(name[j] != 0) // Strcpy
-        {
-            semaphores[semaphore].name[j] = name[j];
-            j++;
-        }
-        semaphores[semaphore].name[j] = 0;
+        semRemoveWaiter(task);
+        setTaskResult(task, WAIT_INVALID);
+        setTaskState(task, STATE_READY);
     }
-    return ok;
+    semaphores[s].live = false;
+    semaphoreWords[s].handle = NO_SEM; // Sends the fast paths holding the old handle to the kernel
+    if(semaphores[s].liveNext == s)
+        semLiveHead = NO_SEMAPHORE;
+    else
+    {
+        semaphores[semaphores[s].livePrev].liveNext = semaphores[s].liveNext;
+        semaphores[semaphores[s].liveNext].livePrev = semaphores[s].livePrev;
+        if(semLiveHead == s)
+            semLiveHead = semaphores[s].liveNext;
+    }
+    semaphores[s].liveNext = semFree;
+    semFree = s;
+    return true;
 }
 
 void tempStart()
@@ -402,8 +1902,9 @@ void tempStart()
     tcb[taskCurrent].state = STATE_READY;
     setSramAccessWindow(tcb[taskCurrent].srd);
     // Systick configuration
-    NVIC_ST_RELOAD_R =  39999; // 1ms
+    NVIC_ST_RELOAD_R = CYCLES_PER_TICK - 1; // 1ms
     NVIC_ST_CTRL_R |= NVIC_ST_CTRL_ENABLE | NVIC_ST_CTRL_INTEN | NVIC_ST_CTRL_CLK_SRC;
+    NVIC_EN0_R = 1 << (INT_UART0 - 16); // Masked in UART0_IM_R until a task waits for input
     NVIC_MPU_CTRL_R = NVIC_MPU_CTRL_ENABLE;
     WTIMER0_CTL_R |= TIMER_CTL_TAEN;
     removePriv();
@@ -415,8 +1916,7 @@ void tempStart()
 void startRtos()
 {
     taskCurrent = rtosScheduler();
-    uint32_t sp = (uint32_t)tcb[taskCurrent].sp;
-    setPSP(sp);
+    setPSP(tcb[taskCurrent].sp);
     setASP();
     tempStart();
 }
@@ -435,18 +1935,132 @@ void sleep(uint32_t tick)
     __asm(" SVC #1");
 }
 
-// REQUIRED: modify this function to wait a semaphore using pendsv
-void wait(int8_t semaphore)
+// Sleeps until the tick counter reaches tick, returns at once if it already has
+void sleepUntil(uint32_t tick)
+{
+    __asm(" SVC #19");
+}
+
+// Sets the criticality of a thread and its per-job budgets in microseconds for LO and HI mode
+bool setThreadCriticality(uint32_t pid, uint8_t criticality, uint32_t loBudgetUs, uint32_t hiBudgetUs)
+{
+    __asm(" SVC #31");
+}
+
+// PID of the task called name, NO_PID if there is none
+uint32_t getPid(const char name[])
+{
+    __asm(" SVC #33");
+}
+
+// Blocks until the next slot of the calling task in the cyclic executive table
+void waitSlot()
+{
+    __asm(" SVC #29");
+}
+
+// Completes the current job of a periodic task and sleeps until the next release
+void waitNextPeriod()
+{
+    __asm(" SVC #20");
+}
+
+// Returns the monotonic 1 ms tick counter
+uint32_t getTickCount()
+{
+    __asm(" SVC #21");
+}
+
+// Creates a semaphore at run time, returns its handle or NO_SEM when the table is full
+uint32_t semCreate(const char name[], uint32_t count)
+{
+    __asm(" SVC #37");
+}
+
+// Deletes a semaphore, tasks waiting on it return WAIT_INVALID
+bool semDelete(uint32_t sem)
+{
+    __asm(" SVC #38");
+}
+
+// Kernel half of wait(), blocks unless the count became nonzero meanwhile
+void semWait(uint32_t sem)
 {
     __asm(" SVC #4");
 }
 
-// REQUIRED: modify this function to signal a semaphore is available using pendsv
-void post(int8_t semaphore)
+// REQUIRED: modify this function to wait a semaphore using pendsv
+void wait(uint32_t sem)
+{
+    if(!semTryWait(&semaphoreWords[SEM_SLOT(sem)].count, sem))
+        semWait(sem);
+}
+
+// Kernel half of waitTimeout()
+uint8_t semWaitTimeout(uint32_t sem, uint32_t ticks)
+{
+    __asm(" SVC #35");
+}
+
+// Like wait(), but gives up after ticks and returns WAIT_TIMEOUT instead of WAIT_OK
+// With 0 ticks it only takes the semaphore if it is available
+uint8_t waitTimeout(uint32_t sem, uint32_t ticks)
+{
+    if(semTryWait(&semaphoreWords[SEM_SLOT(sem)].count, sem))
+        return WAIT_OK;
+    return semWaitTimeout(sem, ticks);
+}
+
+// Blocks until the mutex is free, the owner inherits the caller's priority meanwhile
+// A free ceiling mutex is taken at once and raises the caller to the ceiling
+void lock(int8_t mutex)
+{
+    __asm(" SVC #22");
+}
+
+// Like lock(), but gives up after ticks and returns WAIT_TIMEOUT instead of WAIT_OK
+uint8_t lockTimeout(int8_t mutex, uint32_t ticks)
+{
+    __asm(" SVC #36");
+}
+
+void unlock(int8_t mutex)
+{
+    __asm(" SVC #23");
+}
+
+// Blocks until any bit of mask is set in the event group, or all of them with EVENT_ALL,
+// for at most ticks. Returns the bits of mask that were set, 0 on timeout. With EVENT_CLEAR
+// those bits are cleared as the wait ends
+uint32_t waitEvents(uint8_t group, uint32_t mask, uint8_t options, uint32_t ticks)
+{
+    __asm(" SVC #39");
+}
+
+// Sets bits in the event group, waking every waiter they satisfy
+void postEvents(uint8_t group, uint32_t bits)
+{
+    __asm(" SVC #40");
+}
+
+void clearEvents(uint8_t group, uint32_t bits)
+{
+    __asm(" SVC #41");
+}
+
+// Kernel half of post(), wakes the first waiter
+void semPost(uint32_t sem)
 {
     __asm(" SVC #5");
 }
 
+// REQUIRED: modify this function to signal a semaphore is available using pendsv
+void post(uint32_t sem)
+{
+    if(!semTryPost(&semaphoreWords[SEM_SLOT(sem)].count, sem))
+        semPost(sem);
+}
+
 bool getData(uint8_t type, USER_DATA *data)
 {
     switch(type)
@@ -472,6 +2086,24 @@ bool getData(uint8_t type, USER_DATA *data)
         case SVC_PS:
             __asm(" SVC #14");
             break;
+        case SVC_STATS:
+            __asm(" SVC #15");
+            break;
+        case SVC_TICKLESS:
+            __asm(" SVC #16");
+            break;
+        case SVC_CYCLIC:
+            __asm(" SVC #30");
+            break;
+        case SVC_CRIT:
+            __asm(" SVC #32");
+            break;
+        case SVC_BENCH:
+            __asm(" SVC #34");
+            break;
+        case SVC_AGING:
+            __asm(" SVC #26");
+            break;
     }
 
 }
@@ -480,14 +2112,30 @@ bool getData(uint8_t type, USER_DATA *data)
 void systickIsr()
 {
     uint8_t i;
-    for(i = 0; i < taskCount; i++)
+    uint32_t ticks = tickStride;
+    // The period that just started was loaded with a single tick
+    tickStride = 1;
+    periodLoad = CYCLES_PER_TICK - 1;
+    periodOffset = 0;
+    advanceTicks(ticks);
+    releaseSlots();
+    chargeCpuTime();
+    enforceBudget();
+    // Only the running task's slice counts down
+    if(isReady(tcb[taskCurrent].state))
     {
-        if(tcb[i].state == STATE_DELAYED)
+        if(tcb[taskCurrent].sliceLeft > ticks)
+            tcb[taskCurrent].sliceLeft -= ticks;
+        else
         {
-            if(--(tcb[i].ticks) == 0)
-                tcb[i].state = STATE_READY;
+            rotateTask(taskCurrent);
+            resetAging(taskCurrent);
         }
     }
+    if(schedMode == SCHED_MLFQ && (int32_t)(tickCount - mlfqNext) >= 0)
+        mlfqBoostAll();
+    if(agingTicks && (int32_t)(tickCount - agingNext) >= 0)
+        ageTasks();
     if(WTIMER0_TAV_R > 80000000)
     {
 //        totalTime = WTIMER0_TAV_R;
@@ -500,36 +2148,142 @@ void systickIsr()
     }
     if(preemption)
     {
-        NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        if(rescheduleNeeded())
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+        else
+            switchesAvoided++;
     }
-
+    updateTickStride();
 }
 
 
+// Wakes the task blocked in getcUart0(), the fifo keeps the data for it to read
+// Receive fires at half a fifo, receive time-out after 32 bits of silence with data waiting
+void uart0Isr()
+{
+    UART0_IM_R &= ~(UART_IM_RXIM | UART_IM_RTIM);
+    UART0_ICR_R = UART_ICR_RXIC | UART_ICR_RTIC;
+    if(inputTask != NO_TASK)
+    {
+        setTaskState(inputTask, STATE_READY);
+        inputTask = NO_TASK;
+        checkPreemption();
+        updateTickStride();
+    }
+}
+
 // REQUIRED: in coop and preemptive, modify this function to add support for task switching
 // REQUIRED: process UNRUN and READY tasks differently
-void pendSvIsr()
+// Called from pendSvIsr in rtosASM.s once R4-R11 and EXC_RETURN of the running task are stored below sp
+// Returns the stack of the task to dispatch, pointing at its saved R4-R11
+// start is WTIMER0 at PendSV entry, used to measure the cost of a switch
+uint32_t *pendSvSwitch(uint32_t *sp, uint32_t start)
 {
-    tcb[taskCurrent].time[wr_index] += WTIMER0_TAV_R - timeInitial;
-    pushToPSPStack();   // Pushes R0 - R3, R11, LR, PC, xPSR
-    tcb[taskCurrent].sp = (void *)getPSP();
-    taskCurrent = rtosScheduler();
-    if(tcb[taskCurrent].state == STATE_READY)
+    uint32_t cycles;
+    // The same task is dispatched again, its registers are restored unchanged
+    if(!rescheduleNeeded())
     {
-
-        setSramAccessWindow(tcb[taskCurrent].srd);
-        setPSP((uint32_t)tcb[taskCurrent].sp);
-        popPSPStack();
-
+        switchesAvoided++;
+        return sp;
     }
-    else
+    chargeCpuTime();
+    resetAging(taskCurrent);
+    // The system is idle again once nothing but the idle task is ready
+    if(critMode == CRIT_HI && rrHead == taskIdle && tcb[taskIdle].rrNext == taskIdle)
+        leaveHiMode();
+    tcb[taskCurrent].sp = sp;
+    taskCurrent = rtosScheduler();
+    setSramAccessWindow(tcb[taskCurrent].srd);
+    if(tcb[taskCurrent].state == STATE_UNRUN)
     {
         tcb[taskCurrent].state = STATE_READY;
-        setSramAccessWindow(tcb[taskCurrent].srd);
-        setPSP((uint32_t)tcb[taskCurrent].sp);
-        pushDummyPSPStack(0x61000000, (uint32_t *)tcb[taskCurrent].pid);    // Pushing dummy stack R0 -> R3, R11, LR, PC, xPSR
+        setPSP(tcb[taskCurrent].sp);
+        pushDummyPSPStack(0x61000000, (uint32_t)tcb[taskCurrent].pid);    // Pushing dummy stack R0 -> R3, R12, LR, PC, xPSR, EXC_RETURN and room for R4 - R11
+        tcb[taskCurrent].sp = getPSP();
     }
+    updateTickStride();
     timeInitial = WTIMER0_TAV_R;
+    cycles = timeInitial - start;
+    if(timeInitial > start) // WTIMER0 is rewound by systickIsr every 2 s
+    {
+        switchCycles += cycles;
+        switchesTimed++;
+        if(cycles > switchCyclesMax)
+            switchCyclesMax = cycles;
+    }
+    return tcb[taskCurrent].sp;
+}
+
+// Measures the scheduler with BENCH_STEP more free TCBs made ready as dummies beside the
+// running task at each step, interrupts stay off while they are in the ready lists. The
+// dummies then stay behind, blocked and with PIDs and names, so that the shell can time
+// the PID and name lookups through real SVCs. The next step takes them down again and the
+// step after the one that used the whole pool only does that and returns true
+#define BENCH_STEP 4
+#define BENCH_RUNS 16
+#define BENCH_NAME "bencha"        // the first dummy, its name is looked up through getPid()
+bool benchStep(USER_DATA *data)
+{
+    uint8_t dummies[MAX_TASKS];
+    uint8_t count, built, free = 0, task, i, bucket;
+    uint8_t lastNext;
+    uint32_t start;
+    volatile uint8_t sink;
+    for(task = tcbFree; task != NO_TASK; task = tcb[task].next)
+        dummies[free++] = task;
+    if(free)
+        lastNext = tcb[dummies[free - 1]].next;
+    bucket = nameHash(BENCH_NAME);
+    built = data->savedIndex ? (data->savedIndex - 1) * BENCH_STEP + 1 : 0;
+    if(built > free)
+        built = free;
+    for(i = 0; i < built; i++)
+        tcb[dummies[i]].state = STATE_INVALID;
+    if(built)
+        nameHead[bucket] = tcb[dummies[0]].nameNext;
+    if(data->savedIndex && built == free)
+        return true;
+    count = data->savedIndex * BENCH_STEP + 1 < free ? data->savedIndex * BENCH_STEP + 1 : free;
+    __asm(" CPSID I");
+    for(i = 0; i < count; i++)
+    {
+        task = dummies[i];
+        tcb[task].priority = tcb[taskCurrent].priority;
+        tcb[task].quantum = DEFAULT_QUANTUM;
+        tcb[task].deadline = 0;
+        tcb[task].schedClass = CLASS_FAIR;
+        tcb[task].vruntime = tcb[taskCurrent].vruntime;
+        tcb[task].pass = tcb[taskCurrent].pass;
+        tcb[task].state = STATE_READY;
+        readyInsert(task);
+    }
+    data->value = 1;
+    for(task = tcb[rrHead].rrNext; task != rrHead; task = tcb[task].rrNext)
+        data->value++;
+    start = WTIMER0_TAV_R;
+    for(i = 0; i < BENCH_RUNS; i++)
+        sink = rtosScheduler();
+    data->benchCycles[0] = (WTIMER0_TAV_R - start) / BENCH_RUNS;
+    for(i = 0; i < count; i++)
+    {
+        task = dummies[i];
+        readyRemove(task);
+        tcb[task].state = STATE_BLOCKED; // Valid for setThreadQuantum(), never scheduled
+        newPid(task);
+        stringCopy(tcb[task].name, BENCH_NAME);
+        tcb[task].name[sizeof(BENCH_NAME) - 2] += i;
+        // All in one chain, the first dummy deepest, so a crowded bucket is measured
+        tcb[task].nameNext = i ? dummies[i - 1] : nameHead[bucket];
+    }
+    if(count)
+        nameHead[bucket] = dummies[count - 1];
+    data->benchPid = count ? tcb[dummies[0]].handle : tcb[taskCurrent].handle;
+    // readyInsert reused next, relink the free list
+    for(i = 0; i < free; i++)
+        tcb[dummies[i]].next = i + 1 < free ? dummies[i + 1] : lastNext;
+    __asm(" CPSIE I");
+    data->savedIndex++;
+    return false;
 }
 
 // REQUIRED: modify this function to add support for the service call
@@ -542,13 +2296,34 @@ void svCallIsr()
     switch(value) {
         case SVC_SLEEP:
         {
-            tcb[taskCurrent].state = STATE_DELAYED;
-            tcb[taskCurrent].ticks = *psp;  // Retrieves R0
+            setTaskState(taskCurrent, STATE_DELAYED);
+            sleepInsert(taskCurrent, wakeTicks(*psp));  // Retrieves R0
+            mlfqPromote(taskCurrent);
             NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
             break;
         }
         case SVC_YIELD:
         {
+            rotateTask(taskCurrent);
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            break;
+        }
+        case SVC_INPUT_WAIT:
+        {
+            // A character may have arrived since getcUart0() saw the fifo empty, and
+            // clearing first drops stale status without losing one that lands after the check
+            UART0_ICR_R = UART_ICR_RXIC | UART_ICR_RTIC;
+            if(!(UART0_FR_R & UART_FR_RXFE))
+                break;
+            if(inputTask != NO_TASK)
+                rotateTask(taskCurrent); // One reader blocks at a time, others poll
+            else
+            {
+                inputTask = taskCurrent;
+                setTaskState(taskCurrent, STATE_BLOCKED);
+                mlfqPromote(taskCurrent);
+                UART0_IM_R |= UART_IM_RXIM | UART_IM_RTIM;
+            }
             NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
             break;
         }
@@ -558,43 +2333,97 @@ void svCallIsr()
             break;
         }
         case SVC_WAIT:
+        case SVC_WAIT_TIMEOUT:
         {
-            if (semaphores[*psp].count > 0)
-            {
-                semaphores[*psp].count--;
-                tcb[taskCurrent].hasSemaphore = *psp;
-            }
+            uint32_t ticks = value == SVC_WAIT ? WAIT_FOREVER : *(psp + 1);
+            uint8_t s = semFromHandle(*psp);
+            uint8_t result = WAIT_OK; // Overwritten by advanceTicks if the timeout fires first
+            // A post() may have slipped in between the failed fast path and this call
+            if(s == NO_SEMAPHORE)
+                result = WAIT_INVALID;
+            else if(semaphoreWords[s].count & SEM_COUNT)
+                semaphoreWords[s].count--;
+            else if(ticks == 0)
+                result = WAIT_TIMEOUT;
             else
             {
-                if(semaphores[*psp].queueSize >= MAX_QUEUE_SIZE)
-                    NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Triggers pendsv fault
-
-                semaphores[*psp].processQueue[semaphores[*psp].queueSize] = taskCurrent; // Add current task to Queue
-                semaphores[*psp].queueSize++;
-                tcb[taskCurrent].state = STATE_BLOCKED;
-                tcb[taskCurrent].semaphore = (void *)&semaphores[*psp];
+                semQueueInsert(&semaphores[s], taskCurrent);
+                semaphoreWords[s].count |= SEM_WAITERS;
+                setTaskState(taskCurrent, STATE_BLOCKED);
+                tcb[taskCurrent].semaphore = (void *)&semaphores[s];
+                if(ticks != WAIT_FOREVER)
+                {
+                    sleepInsert(taskCurrent, wakeTicks(ticks));
+                    tcb[taskCurrent].timedWait = true;
+                }
+                mlfqPromote(taskCurrent);
                 NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Triggers pendsv fault
             }
+            pushPSPRegisterOffset(OFFSET_R0, result);
             break;
         }
         case SVC_POST:
         {
-            tcb[taskCurrent].hasSemaphore = -1;
-            semaphores[*psp].count++;
-            if(semaphores[*psp].queueSize > 0)
+            uint8_t s = semFromHandle(*psp);
+            if(s != NO_SEMAPHORE && semRelease(s))
+                checkPreemption();
+            break;
+        }
+        case SVC_WAIT_EVENTS:
+        {
+            uint8_t group = *psp;
+            uint32_t mask = *(psp + 1);
+            uint8_t options = *(psp + 2);
+            uint32_t ticks = *(psp + 3);
+            uint32_t result = 0; // Set by setEvents when the bits arrive
+            if(group >= MAX_EVENT_GROUPS || mask == 0)
+                result = 0;
+            else if(eventsMatch(eventGroups[group].flags, mask, options))
+            {
+                result = eventGroups[group].flags & mask;
+                if(options & EVENT_CLEAR)
+                    eventGroups[group].flags &= ~mask;
+            }
+            else if(ticks != 0)
             {
-                tcb[semaphores[*psp].processQueue[0]].state = STATE_READY;
-                tcb[semaphores[*psp].processQueue[0]].hasSemaphore = *psp;
-                tcb[semaphores[*psp].processQueue[0]].semaphore = 0;
-                semaphores[*psp].queueSize--;
-                uint8_t i;
-                for(i = 0; i < semaphores[*psp].queueSize; i++)
+                tcb[taskCurrent].eventMask = mask;
+                tcb[taskCurrent].eventOptions = options;
+                eventQueueInsert(group, taskCurrent);
+                setTaskState(taskCurrent, STATE_BLOCKED);
+                if(ticks != WAIT_FOREVER)
                 {
-                    semaphores[*psp].processQueue[i] = semaphores[*psp].processQueue[i + 1];
+                    sleepInsert(taskCurrent, wakeTicks(ticks));
+                    tcb[taskCurrent].timedWait = true;
                 }
-                semaphores[*psp].count--;
+                mlfqPromote(taskCurrent);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
             }
-//            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Triggers pendsv fault
+            pushPSPRegisterOffset(OFFSET_R0, result);
+            break;
+        }
+        case SVC_SET_EVENTS:
+        {
+            if(*psp < MAX_EVENT_GROUPS)
+                setEvents(*psp, *(psp + 1));
+            break;
+        }
+        case SVC_CLEAR_EVENTS:
+        {
+            if(*psp < MAX_EVENT_GROUPS)
+                eventGroups[*psp].flags &= ~*(psp + 1);
+            break;
+        }
+        case SVC_SEM_CREATE:
+        {
+            pushPSPRegisterOffset(OFFSET_R0, createSemaphore((char *)*psp, *(psp + 1)));
+            break;
+        }
+        case SVC_SEM_DELETE:
+        {
+            bool ok = deleteSemaphore(*psp);
+            pushPSPRegisterOffset(OFFSET_R0, ok);
+            if(ok)
+                checkPreemption();
             break;
         }
         case SVC_MALLOC:
@@ -632,14 +2461,12 @@ void svCallIsr()
         }
         case SVC_SETPRIORITY:
         {
-            uint8_t i;
-            for(i = 0; i < taskCount; i++)
+            uint8_t i = taskFromPid(*psp);
+            if(i != NO_TASK)
             {
-                if((uint32_t)tcb[i].pid == *psp)
-                {
-                    tcb[i].priority = *(psp + 1);
-                    break;
-                }
+                tcb[i].priorityInit = *(psp + 1);
+                refreshPriority(i); // Keeps any inherited priority
+                checkPreemption();
             }
             break;
         }
@@ -649,15 +2476,8 @@ void svCallIsr()
             USER_DATA *data = (USER_DATA *) *(psp + 1);
             uint8_t i = 0;
             bool ok = false;
-            uint32_t requestedPid = getFieldInteger(data, 1);
-
-            while(!ok && i < taskCount)
-            {
-                if ((uint32_t *) tcb[i].pid == requestedPid)
-                    break;
-                i++;
-            }
-            if(i == taskCount)
+            i = taskFromPid(getFieldInteger(data, 1));
+            if(i == NO_TASK)
             {
                 pushPSPRegisterOffset(OFFSET_R0, 1); // Pid not found
                 break;
@@ -734,176 +2554,452 @@ void svCallIsr()
         }
         case SVC_PIDOF:
         {
-            bool ok = false;
             USER_DATA *data = (USER_DATA *) *(psp + 1);
+            uint8_t i = findTask(getFieldString(data, 1));
+            bool ok = i != NO_TASK && tcb[i].state != STATE_INVALID;
+            if(ok)
+                data->value = tcb[i].handle;
+            pushPSPRegisterOffset(OFFSET_R0, ok); // Invalid name
+            break;
+        }
+        case SVC_IPCS:
+        {
+            // Rows are the live semaphores followed by the mutexes, unnamed mutexes are skipped
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
+            uint8_t row = data->savedIndex;
             uint8_t i = 0;
-            while(!ok && i < taskCount)
+            // A semaphore deleted since the last call has left the live list, start over
+            if(row == 0 || (row < IPCS_MUTEXES && !semaphores[row - 1].live))
+                row = semLiveHead == NO_SEMAPHORE ? IPCS_MUTEXES : semLiveHead + 1;
+            while(row < IPCS_ROWS && !ipcsRowUsed(row))
+                row++;
+            data->shellOutput[0] = 0;
+            if(row < IPCS_MUTEXES)
+            {
+                // "Name\t\t\tCount\t\t\tNext process waiting
+                semaphore *sem = &semaphores[row - 1];
+                i = stringAppend(data->shellOutput, i, sem->name);
+                i = stringAppend(data->shellOutput, i, "\t\t\t");
+                data->shellOutput[i++] = (semaphoreWords[row - 1].count & SEM_COUNT) + '0';
+                i = stringAppend(data->shellOutput, i, "\t\t\t");
+                if(semQueueFirst(sem) != NO_TASK)
+                    i = stringAppend(data->shellOutput, i, tcb[semQueueFirst(sem)].name);
+            }
+            else if(row < IPCS_EVENTS)
             {
-                if((ok = stringCompare(getFieldString(data, 1), tcb[i].name)))
+                // Also shows the owner and its priority, with the base priority when boosted
+                mutex *mtx = &mutexes[row - IPCS_MUTEXES];
+                i = stringAppend(data->shellOutput, i, mtx->name);
+                i = stringAppend(data->shellOutput, i, "\t\t\t");
+                data->shellOutput[i++] = (mtx->owner == NO_OWNER) + '0';
+                i = stringAppend(data->shellOutput, i, "\t\t\t");
+                if(mtx->queueSize > 0)
+                    i = stringAppend(data->shellOutput, i, tcb[mtx->processQueue[0]].name);
+                i = stringAppend(data->shellOutput, i, "\t\t\t");
+                if(mtx->owner != NO_OWNER)
                 {
-                    if(tcb[i].state == STATE_INVALID)
-                        break;
-                    data->value = (uint32_t)tcb[i].pid;
-                    ok = true;
-                    break;
+                    i = stringAppend(data->shellOutput, i, tcb[mtx->owner].name);
+                    i = stringAppend(data->shellOutput, i, "\t\t\t");
+                    data->shellOutput[i++] = tcb[mtx->owner].priority + '0';
+                    if(tcb[mtx->owner].priority != tcb[mtx->owner].priorityInit)
+                    {
+                        i = stringAppend(data->shellOutput, i, " (base ");
+                        data->shellOutput[i++] = tcb[mtx->owner].priorityInit + '0';
+                        data->shellOutput[i++] = ')';
+                    }
+                    data->shellOutput[i] = 0;
+                }
+                else
+                    i = stringAppend(data->shellOutput, i, "\t\t\t");
+                if(mtx->ceiling != NO_CEILING)
+                {
+                    i = stringAppend(data->shellOutput, i, "\t\t\t");
+                    data->shellOutput[i++] = mtx->ceiling + '0';
+                    data->shellOutput[i] = 0;
                 }
-                i++;
             }
-            pushPSPRegisterOffset(OFFSET_R0, ok); // Invalid name
+            else if(row < IPCS_ROWS)
+            {
+                // The flags in hex in the count column
+                eventGroup *grp = &eventGroups[row - IPCS_EVENTS];
+                uint8_t j;
+                i = stringAppend(data->shellOutput, i, grp->name);
+                i = stringAppend(data->shellOutput, i, "\t\t\t0x");
+                for(j = 0; j < 8; j++)
+                    data->shellOutput[i++] = "0123456789ABCDEF"[(grp->flags >> (28 - 4 * j)) & 0xF];
+                data->shellOutput[i] = 0;
+                i = stringAppend(data->shellOutput, i, "\t\t\t");
+                if(grp->waitHead != NO_TASK)
+                    i = stringAppend(data->shellOutput, i, tcb[grp->waitHead].name);
+            }
+            if(row < IPCS_MUTEXES)
+                row = ipcsNextSemaphore(row - 1);
+            else
+                row++;
+            while(row < IPCS_ROWS && !ipcsRowUsed(row))
+                row++;
+            data->savedIndex = row;
+            pushPSPRegisterOffset(OFFSET_R0, row >= IPCS_ROWS); // Done sending data
             break;
         }
-        case SVC_IPCS:
+        case SVC_PREEMPT:
+        {
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
+            preemption = data->value ;
+            break;
+        }
+        case SVC_PRIORITY:
+        {
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
+            bool ok = data->value <= SCHED_CLASS; // The SCHED_ values run from 0 to SCHED_CLASS
+            if(ok)
+            {
+                schedMode = data->value;
+                mlfqBoostAll(); // Effective priorities follow the levels only under MLFQ
+                checkPreemption();
+            }
+            pushPSPRegisterOffset(OFFSET_R0, ok);
+            break;
+        }
+        case SVC_TICKLESS:
+        {
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
+            tickless = data->value;
+            updateTickStride();
+            break;
+        }
+        case SVC_CYCLIC:
+        {
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
+            cyclic = data->value;
+            slotNext = 0;
+            frameStart = currentTick() + 1; // The major frame starts at the next tick
+            break;
+        }
+        case SVC_AGING:
         {
             USER_DATA *data = (USER_DATA *) *(psp + 1);
-            if(data->savedIndex== 0)
-                data->savedIndex= 1;
+            uint8_t i;
+            agingTicks = data->value;
+            agingNext = tickCount + agingTicks;
+            if(!agingTicks)
+                for(i = 0; i < taskCount; i++)
+                    resetAging(i);
+            checkPreemption();
+            break;
+        }
+        case SVC_REBOOT:
+        {
+            NVIC_APINT_R = NVIC_APINT_VECTKEY | NVIC_APINT_SYSRESETREQ;
+        }
+        case SVC_PS:
+        {
             bool ok = false;
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
             uint8_t i = 0;
-            uint8_t j = 0;
+            data->savedIndex = data->savedIndex % 100;
+            while(tcb[data->savedIndex].state == STATE_INVALID && data->savedIndex < taskCount)
+                data->savedIndex++;
 
-            // String copy "Name\t\t\tCount\t\t\tNext process waiting
-            while(semaphores[data->savedIndex].name[i] != 0)
+            while(tcb[data->savedIndex % 100].name[i] != 0)
             {
-                data->shellOutput[i] = semaphores[data->savedIndex].name[i];
+                data->shellOutput[i] = tcb[data->savedIndex].name[i];
                 i++;
             }
-            data->shellOutput[i++] = '\t';
-            data->shellOutput[i++] = '\t';
-            data->shellOutput[i++] = '\t';
-            data->shellOutput[i++] = semaphores[data->savedIndex].count + '0';
-            data->shellOutput[i++] = '\t';
-            data->shellOutput[i++] = '\t';
-            data->shellOutput[i++] = '\t';
+            data->shellOutput[i] = 0;
+            data->value = tcb[data->savedIndex].handle;
+            data->priority = tcb[data->savedIndex].priority;
+            data->basePriority = tcb[data->savedIndex].priorityInit;
+            data->time = (tcb[data->savedIndex].time[1 - wr_index]) / (totalTime[1 - wr_index] / 10000);
+            data->deadline = tcb[data->savedIndex].deadline;
+            data->lateness = tcb[data->savedIndex].lateness;
+            data->misses = tcb[data->savedIndex].misses;
+            data->budget = tcb[data->savedIndex].budget / CYCLES_PER_US;
+            data->budgetUsed = tcb[data->savedIndex].budgetUsed / CYCLES_PER_US;
+            data->throttles = tcb[data->savedIndex].throttles;
+            data->tickets = tcb[data->savedIndex].tickets;
+            data->schedClass = tcb[data->savedIndex].schedClass;
+            data->vruntime = tcb[data->savedIndex].vruntime / CYCLES_PER_TICK;
+            data->savedIndex += tcb[data->savedIndex].state * 100;
 
-            while(tcb[semaphores[data->savedIndex].processQueue[0]].name[j] != 0)
+            data->savedIndex++;
+            ok = data->savedIndex % 100 == taskCount;
+            pushPSPRegisterOffset(OFFSET_R0, ok); // False = needs more data
+            break;
+        }
+        case SVC_STATS:
+        {
+            USER_DATA *data = (USER_DATA *) *(psp + 1);
+            data->percent = false;
+            switch(data->savedIndex)
+            {
+                case STAT_SWITCHES_AVOIDED:
+                    stringCopy(data->shellOutput, "Switches avoided");
+                    data->value = switchesAvoided;
+                    break;
+                case STAT_IDLE_RESIDENCY:
+                    stringCopy(data->shellOutput, "Idle residency");
+                    data->value = tickCount ? ((uint64_t)idleTicks * 10000) / tickCount : 0;
+                    data->percent = true;
+                    break;
+                case STAT_SLOT_OVERRUNS:
+                    stringCopy(data->shellOutput, "Slot overruns");
+                    data->value = slotOverruns;
+                    break;
+                case STAT_SWITCH_CYCLES:
+                    stringCopy(data->shellOutput, "Cycles per switch");
+                    data->value = switchesTimed ? switchCycles / switchesTimed : 0;
+                    break;
+                case STAT_SWITCH_CYCLES_MAX:
+                    stringCopy(data->shellOutput, "Max cycles per switch");
+                    data->value = switchCyclesMax;
+                    break;
+            }
+            data->savedIndex++;
+            pushPSPRegisterOffset(OFFSET_R0, data->savedIndex == STAT_COUNT); // Done sending data
+            break;
+        }
+        case SVC_STOP:
+        {
+            bool ok = false;
+            uint8_t i = taskFromPid(*psp);
+            if(i != NO_TASK && tcb[i].state != STATE_INVALID)
+            {
+                if(slotTask == i)
+                    slotTask = NO_TASK;
+                if(tcb[i].mutex != NO_MUTEX)
+                    mutexRemoveWaiter(i);
+                else if(tcb[i].slotWait)
+                    tcb[i].slotWait = false;
+                else if(inputTask == i)
+                    inputTask = NO_TASK;
+                else if(tcb[i].eventGroup != NO_EVENTS)
+                    eventRemoveWaiter(i);
+                else if(tcb[i].state == STATE_BLOCKED)
+                    semRemoveWaiter(i);
+                else if(tcb[i].state == STATE_DELAYED)
+                    sleepRemove(i);
+                mutexReleaseAll(i);
+                setTaskState(i, STATE_INVALID);
+                freeMemoryBlocks(tcb[i].srd);
+                ok = true;
+                if(i == taskCurrent)
+                    NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Context switch
+                else
+                    checkPreemption();
+            }
+            pushPSPRegisterOffset(OFFSET_R0, ok); // Restart successful
+            break;
+        }
+        case SVC_RESTART:
+        {
+            char *func = *psp;
+            bool ok = false;
+            uint8_t i = findTask(func);
+            if(i != NO_TASK && tcb[i].state == STATE_INVALID)
+            {
+                newPid(i);
+                tcb[i].priority = tcb[i].priorityInit;
+                tcb[i].sp = tcb[i].spInit;
+                tcb[i].budgetUsed = 0;
+                tcb[i].replenish = tickCount + tcb[i].budgetPeriod;
+                setTaskState(i, STATE_UNRUN);
+                ok = true;
+                checkPreemption();
+            }
+            pushPSPRegisterOffset(OFFSET_R0, ok); // Restart successful
+            break;
+        }
+        case SVC_SLEEP_UNTIL:
+        {
+            // tickCount is the start of the running period, where sleep deltas are measured from
+            if((int32_t)(*psp - currentTick()) > 0)
+            {
+                setTaskState(taskCurrent, STATE_DELAYED);
+                sleepInsert(taskCurrent, *psp - tickCount);
+                mlfqPromote(taskCurrent);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+            break;
+        }
+        case SVC_WAIT_PERIOD:
+        {
+            if(!tcb[taskCurrent].period)
+            {
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Not periodic, same as yield
+                break;
+            }
+            uint32_t release = tcb[taskCurrent].release + tcb[taskCurrent].period;
+            completeJob(taskCurrent);
+            if((int32_t)(release - currentTick()) > 0)
+            {
+                setTaskState(taskCurrent, STATE_DELAYED);
+                releaseJob(taskCurrent, release);
+                sleepInsert(taskCurrent, release - tickCount);
+                mlfqPromote(taskCurrent);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+            else
+            {
+                // An overrun job releases the next one at once, requeued by its new deadline
+                readyRemove(taskCurrent);
+                releaseJob(taskCurrent, release);
+                readyInsert(taskCurrent);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+            break;
+        }
+        case SVC_TICK_COUNT:
+        {
+            pushPSPRegisterOffset(OFFSET_R0, currentTick());
+            break;
+        }
+        case SVC_SETQUANTUM:
+        {
+            uint8_t i = taskFromPid(*psp);
+            bool ok = i != NO_TASK && tcb[i].state != STATE_INVALID && *(psp + 1) > 0 && *(psp + 1) <= UINT16_MAX;
+            if(ok)
             {
-                data->shellOutput[i++] = tcb[semaphores[data->savedIndex].processQueue[0]].name[j];
-                j++;
+                tcb[i].quantum = *(psp + 1);
+                if(tcb[i].sliceLeft > tcb[i].quantum)
+                    tcb[i].sliceLeft = tcb[i].quantum;
             }
-
-            data->shellOutput[i] = 0; // Null Character
-            data->savedIndex++;
-            if(data->savedIndex== MAX_SEMAPHORES)
-                pushPSPRegisterOffset(OFFSET_R0, 1); // Done sending data
-            else
-                pushPSPRegisterOffset(OFFSET_R0, 0); // Not done sending data
+            pushPSPRegisterOffset(OFFSET_R0, ok);
             break;
         }
-        case SVC_PREEMPT:
+        case SVC_GETPID:
         {
-            USER_DATA *data = (USER_DATA *) *(psp + 1);
-            preemption = data->value ;
+            uint8_t i = findTask((char *)*psp);
+            pushPSPRegisterOffset(OFFSET_R0, i == NO_TASK ? NO_PID : tcb[i].handle);
             break;
         }
-        case SVC_PRIORITY:
+        case SVC_BENCH:
         {
             USER_DATA *data = (USER_DATA *) *(psp + 1);
-            priority = data->value ;
+            pushPSPRegisterOffset(OFFSET_R0, benchStep(data)); // Done sending data
             break;
         }
-        case SVC_REBOOT:
+        case SVC_SETCRIT:
         {
-            NVIC_APINT_R = NVIC_APINT_VECTKEY | NVIC_APINT_SYSRESETREQ;
+            pushPSPRegisterOffset(OFFSET_R0, setCriticality(*psp, *(psp + 1), *(psp + 2), *(psp + 3)));
+            break;
         }
-        case SVC_PS:
+        case SVC_CRIT:
         {
-            bool ok = false;
             USER_DATA *data = (USER_DATA *) *(psp + 1);
-            uint8_t i = 0;
-            data->savedIndex = data->savedIndex % 100;
-            while(tcb[data->savedIndex].state == STATE_INVALID && data->savedIndex < taskCount)
-                data->savedIndex++;
-
-            while(tcb[data->savedIndex % 100].name[i] != 0)
+            switch(data->savedIndex)
             {
-                data->shellOutput[i] = tcb[data->savedIndex].name[i];
-                i++;
+                case CRIT_STAT_MODE:
+                    stringCopy(data->shellOutput, critMode == CRIT_HI ? "Mode\t\t\tHI" : "Mode\t\t\tLO");
+                    break;
+                case CRIT_STAT_SWITCHES:
+                    stringCopy(data->shellOutput, "Switches to HI mode");
+                    data->value = hiModeSwitches;
+                    break;
+                case CRIT_STAT_HI_TIME:
+                    stringCopy(data->shellOutput, "Time in HI mode (ms)");
+                    data->value = hiModeTicks + (critMode == CRIT_HI ? currentTick() - hiModeStart : 0);
+                    break;
+                case CRIT_STAT_OVERRUNS:
+                    stringCopy(data->shellOutput, "HI budget overruns");
+                    data->value = hiOverruns;
+                    break;
             }
-            data->shellOutput[i] = 0;
-            data->value = (uint32_t)tcb[data->savedIndex].pid;
-            data->time = (tcb[data->savedIndex].time[1 - wr_index]) / (totalTime[1 - wr_index] / 10000);
-            data->savedIndex += tcb[data->savedIndex].state * 100;
-
             data->savedIndex++;
-            ok = data->savedIndex % 100 == taskCount;
-            pushPSPRegisterOffset(OFFSET_R0, ok); // False = needs more data
+            pushPSPRegisterOffset(OFFSET_R0, data->savedIndex == CRIT_STAT_COUNT); // Done sending data
             break;
         }
-        case SVC_STOP:
+        case SVC_WAIT_SLOT:
         {
-            bool ok = false;
-            uint8_t i, j;
-            for(i = 0; i < taskCount; i++)
+            if(slotTask == taskCurrent)
+                slotTask = NO_TASK;
+            tcb[taskCurrent].slotWait = true;
+            setTaskState(taskCurrent, STATE_BLOCKED);
+            NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            break;
+        }
+        case SVC_SETCLASS:
+        {
+            uint8_t i = taskFromPid(*psp);
+            bool ok = i != NO_TASK && tcb[i].state != STATE_INVALID && i != taskIdle
+                    && (*(psp + 1) == CLASS_RT || *(psp + 1) == CLASS_FAIR);
+            if(ok && isReady(tcb[i].state))
             {
-                if ((uint32_t *) tcb[i].pid == *psp)
-                {
-                    if(tcb[i].state == STATE_BLOCKED)
-                    {
-                        // Remove process from process queue
-                        for(j = 0; j < ((semaphore *)(tcb[i].semaphore))->queueSize; j++)
-                        {
-                            if (((semaphore *) (tcb[i].semaphore))->processQueue[j] == i)
-                                ((semaphore *) (tcb[i].semaphore))->processQueue[j] = 0;
-
-                            if(((semaphore *) (tcb[i].semaphore))->processQueue[j] == 0)
-                            {
-                                ((semaphore *) (tcb[i].semaphore))->processQueue[j] = ((semaphore *) (tcb[i].semaphore))->processQueue[j + 1];
-                                ((semaphore *) (tcb[i].semaphore))->processQueue[j + 1] = 0;
-                            }
-                        }
-                        tcb[i].semaphore = 0;
-                        ((semaphore *)(tcb[i].semaphore))->queueSize--;
-                    }
-                    else if(tcb[i].state == STATE_DELAYED)
-                        tcb[i].ticks = 0;
-                    else if(tcb[i].hasSemaphore != -1)
-                    {
-                        // Post semaphore
-                        semaphores[tcb[i].hasSemaphore].count++;
-                        if(semaphores[tcb[i].hasSemaphore].queueSize > 0)
-                        {
-                            tcb[semaphores[tcb[i].hasSemaphore].processQueue[0]].state = STATE_READY;
-                            tcb[semaphores[tcb[i].hasSemaphore].processQueue[0]].hasSemaphore = tcb[i].hasSemaphore;
-                            tcb[semaphores[tcb[i].hasSemaphore].processQueue[0]].semaphore = 0;
-                            semaphores[tcb[i].hasSemaphore].queueSize--;
-                            uint8_t j;
-                            for(j = 0; j < semaphores[tcb[i].hasSemaphore].queueSize; j++)
-                            {
-                                semaphores[tcb[i].hasSemaphore].processQueue[j] = semaphores[tcb[i].hasSemaphore].processQueue[j + 1];
-                            }
-                            semaphores[tcb[i].hasSemaphore].count--;
-                        }
-                        tcb[i].hasSemaphore = -1;
-                    }
-                    tcb[i].state = STATE_INVALID;
-                    freeMemoryBlocks(tcb[i].srd);
-                    ok = true;
-                    NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Context switch
-                }
+                readyRemove(i);
+                tcb[i].schedClass = *(psp + 1);
+                fairJoin(i);
+                readyInsert(i);
             }
-            pushPSPRegisterOffset(OFFSET_R0, ok); // Restart successful
+            else if(ok)
+                tcb[i].schedClass = *(psp + 1);
+            checkPreemption();
+            pushPSPRegisterOffset(OFFSET_R0, ok);
             break;
         }
-        case SVC_RESTART:
+        case SVC_SETSHARE:
         {
-            char *func = *psp;
-            bool ok = false;
-            uint8_t i;
-            for(i = 0; i < taskCount; i++)
+            uint8_t i = taskFromPid(*psp);
+            bool ok = i != NO_TASK && tcb[i].state != STATE_INVALID
+                    && *(psp + 1) > 0 && *(psp + 1) <= MAX_TICKETS;
+            if(ok)
+            {
+                tcb[i].tickets = *(psp + 1);
+                tcb[i].stride = STRIDE1 / tcb[i].tickets;
+            }
+            checkPreemption();
+            pushPSPRegisterOffset(OFFSET_R0, ok);
+            break;
+        }
+        case SVC_SETBUDGET:
+        {
+            pushPSPRegisterOffset(OFFSET_R0, setBudget(*psp, *(psp + 1), *(psp + 2)));
+            break;
+        }
+        case SVC_LOCK:
+        case SVC_LOCK_TIMEOUT:
+        {
+            mutex *mtx = *psp < MAX_MUTEXES ? &mutexes[*psp] : 0;
+            uint32_t ticks = value == SVC_LOCK ? WAIT_FOREVER : *(psp + 1);
+            uint8_t result = WAIT_OK; // Overwritten by advanceTicks if the timeout fires first
+            if(!mtx)
+                result = WAIT_INVALID;
+            else if(mtx->owner == NO_OWNER)
+            {
+                mtx->owner = taskCurrent;
+                tcb[taskCurrent].mutexesHeld |= 1 << *psp;
+                if(mtx->ceiling < tcb[taskCurrent].priority)
+                    setTaskPriority(taskCurrent, mtx->ceiling);
+            }
+            else if(mtx->owner != taskCurrent && ticks == 0)
+                result = WAIT_TIMEOUT;
+            else if(mtx->owner != taskCurrent)
             {
-                if(stringCompare(func, tcb[i].name) && tcb[i].state == STATE_INVALID)
+                mtx->processQueue[mtx->queueSize++] = taskCurrent;
+                tcb[taskCurrent].mutex = *psp;
+                setTaskState(taskCurrent, STATE_BLOCKED);
+                if(ticks != WAIT_FOREVER)
                 {
-                    tcb[i].priority = tcb[i].priorityInit;
-                    tcb[i].sp = tcb[i].spInit;
-                    tcb[i].state = STATE_UNRUN;
-                    ok = true;
-                    NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Context swtich
+                    sleepInsert(taskCurrent, wakeTicks(ticks));
+                    tcb[taskCurrent].timedWait = true;
                 }
+                mlfqPromote(taskCurrent);
+                refreshPriority(mtx->owner);
+                NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV;
+            }
+            pushPSPRegisterOffset(OFFSET_R0, result);
+            break;
+        }
+        case SVC_UNLOCK:
+        {
+            if(*psp < MAX_MUTEXES && mutexes[*psp].owner == taskCurrent)
+            {
+                mutexRelease(taskCurrent, *psp);
+                checkPreemption();
             }
-            pushPSPRegisterOffset(OFFSET_R0, ok); // Restart successful
             break;
         }
     }
+    updateTickStride();
 }
 
 void mpuFaultIsr()
@@ -930,46 +3026,16 @@ void mpuFaultIsr()
         putsUart0("\n");
     }
     
-    if(tcb[taskCurrent].state == STATE_BLOCKED)
-    {
-        // Remove process from process queue
-        uint8_t j;
-        for(j = 0; j < ((semaphore *)(tcb[taskCurrent].semaphore))->queueSize; j++)
-        {
-            if (((semaphore *) (tcb[taskCurrent].semaphore))->processQueue[j] == taskCurrent)
-                ((semaphore *) (tcb[taskCurrent].semaphore))->processQueue[j] = 0;
-
-            if(((semaphore *) (tcb[taskCurrent].semaphore))->processQueue[j] == 0)
-            {
-                ((semaphore *) (tcb[taskCurrent].semaphore))->processQueue[j] = ((semaphore *) (tcb[taskCurrent].semaphore))->processQueue[j + 1];
-                ((semaphore *) (tcb[taskCurrent].semaphore))->processQueue[j + 1] = 0;
-            }
-        }
-        tcb[taskCurrent].semaphore = 0;
-        ((semaphore *)(tcb[taskCurrent].semaphore))->queueSize--;
-    }
+    if(tcb[taskCurrent].mutex != NO_MUTEX)
+        mutexRemoveWaiter(taskCurrent);
+    else if(tcb[taskCurrent].eventGroup != NO_EVENTS)
+        eventRemoveWaiter(taskCurrent);
+    else if(tcb[taskCurrent].state == STATE_BLOCKED)
+        semRemoveWaiter(taskCurrent);
     else if(tcb[taskCurrent].state == STATE_DELAYED)
-        tcb[taskCurrent].ticks = 0;
-    else if(tcb[taskCurrent].hasSemaphore != -1)
-    {
-        // Post semaphore
-        semaphores[tcb[taskCurrent].hasSemaphore].count++;
-        if(semaphores[tcb[taskCurrent].hasSemaphore].queueSize > 0)
-        {
-            tcb[semaphores[tcb[taskCurrent].hasSemaphore].processQueue[0]].state = STATE_READY;
-            tcb[semaphores[tcb[taskCurrent].hasSemaphore].processQueue[0]].hasSemaphore = tcb[taskCurrent].hasSemaphore;
-            tcb[semaphores[tcb[taskCurrent].hasSemaphore].processQueue[0]].semaphore = 0;
-            semaphores[tcb[taskCurrent].hasSemaphore].queueSize--;
-            uint8_t j;
-            for(j = 0; j < semaphores[tcb[taskCurrent].hasSemaphore].queueSize; j++)
-            {
-                semaphores[tcb[taskCurrent].hasSemaphore].processQueue[j] = semaphores[tcb[taskCurrent].hasSemaphore].processQueue[j + 1];
-            }
-            semaphores[tcb[taskCurrent].hasSemaphore].count--;
-        }
-        tcb[taskCurrent].hasSemaphore = -1;
-    }
-    tcb[taskCurrent].state = STATE_INVALID;
+        sleepRemove(taskCurrent);
+    mutexReleaseAll(taskCurrent);
+    setTaskState(taskCurrent, STATE_INVALID);
     freeMemoryBlocks(tcb[taskCurrent].srd);
     NVIC_SYS_HND_CTRL_R &= ~(NVIC_SYS_HND_CTRL_MEMP); // Clear MPU fault pending bit
     NVIC_INT_CTRL_R |= NVIC_INT_CTRL_PEND_SV; // Context swtich
@@ -978,7 +3044,7 @@ void mpuFaultIsr()
 void hardFaultIsr()
 {
     putsUart0("Hard fault in process ");
-    putiUart0((int32_t)tcb[taskCurrent].pid);
+    putiUart0(tcb[taskCurrent].handle);
     putsUart0("\n");
     putsUart0("HFault flags: ");
     putxUart0(NVIC_HFAULT_STAT_R);
@@ -988,7 +3054,7 @@ void hardFaultIsr()
 void busFaultIsr()
 {
     putsUart0("Bus fault in process ");
-    putiUart0((int32_t)tcb[taskCurrent].pid);
+    putiUart0(tcb[taskCurrent].handle);
     putsUart0("\n");
     while(1);
 }
@@ -997,7 +3063,7 @@ void usageFaultIsr()
 {
     uint32_t pid = 0;
     putsUart0("Usage fault in process ");
-    putiUart0((int32_t)tcb[taskCurrent].pid);
+    putiUart0(tcb[taskCurrent].handle);
     putsUart0("\n");
     while(1);
 }
@@ -1014,6 +3080,10 @@ void initHw()
     initSystemClockTo40Mhz();
     NVIC_SYS_HND_CTRL_R |= NVIC_SYS_HND_CTRL_USAGE | NVIC_SYS_HND_CTRL_MEM | NVIC_SYS_HND_CTRL_BUS;
 
+    // FPU with lazy stacking, exception entry only reserves room for S0 - S15 of tasks using it
+    NVIC_CPAC_R |= NVIC_CPAC_CP10_FULL | NVIC_CPAC_CP11_FULL;
+    NVIC_FPCC_R |= NVIC_FPCC_ASPEN | NVIC_FPCC_LSPEN;
+
     enablePort(PORTA);
     enablePort(PORTB);
     enablePort(PORTC);
@@ -1076,6 +3146,26 @@ uint8_t readPbs()
 // REQUIRED: add any custom code in this space
 //-----------------------------------------------------------------------------
 
+// Appends src at index i of dst and returns the index of the new terminator
+uint8_t stringAppend(char *dst, uint8_t i, const char *src)
+{
+    while(*src != 0)
+        dst[i++] = *src++;
+    dst[i] = 0;
+    return i;
+}
+
+void stringCopy(char *dst, const char *src)
+{
+    uint8_t i = 0;
+    while(src[i] != 0)
+    {
+        dst[i] = src[i];
+        i++;
+    }
+    dst[i] = 0;
+}
+
 uint32_t srdToSize(uint32_t srd)
 {
     uint32_t size = 0;
@@ -1127,7 +3217,7 @@ void idle()
     while(true)
     {
         setPinValue(ORANGE_LED, 1);
-        waitMicrosecond(1000);
+        __asm(" WFI"); // Sleep until the next interrupt
         setPinValue(ORANGE_LED, 0);
         yield();
     }
@@ -1138,7 +3228,17 @@ void flash4Hz()
     while(true)
     {
         setPinValue(GREEN_LED, !getPinValue(GREEN_LED));
-        sleep(125);
+        waitNextPeriod();
+    }
+}
+
+// Cyclic executive variant of flash4Hz, released by the slot table while cyclic is ON
+void flashCyclic()
+{
+    while(true)
+    {
+        waitSlot();
+        setPinValue(GREEN_LED, !getPinValue(GREEN_LED));
     }
 }
 
@@ -1146,10 +3246,17 @@ void oneshot()
 {
     while(true)
     {
-        wait(flashReq);
+        // Without a request for 10 s the wait times out and starts over
+        if(waitTimeout(flashReq, 10000) != WAIT_OK)
+            continue;
+        // Never sleep holding a ceiling mutex, the other users would have to wait
+        lock(yellowLed);
         setPinValue(YELLOW_LED, 1);
+        unlock(yellowLed);
         sleep(1000);
+        lock(yellowLed);
         setPinValue(YELLOW_LED, 0);
+        unlock(yellowLed);
     }
 }
 
@@ -1173,13 +3280,13 @@ void lengthyFn()
 
     while(true)
     {
-        wait(resource);
+        lock(resource);
         for (i = 0; i < 5000; i++)
         {
             partOfLengthyFn();
         }
         setPinValue(RED_LED, !getPinValue(RED_LED));
-        post(resource);
+        unlock(resource);
     }
 }
 
@@ -1188,17 +3295,19 @@ void readKeys()
     uint8_t buttons;
     while(true)
     {
-        wait(keyReleased);
+        waitEvents(keyEvents, KEY_RELEASED, EVENT_CLEAR, WAIT_FOREVER);
         buttons = 0;
         while (buttons == 0)
         {
             buttons = readPbs();
             yield();
         }
-        post(keyPressed);
+        postEvents(keyEvents, KEY_PRESSED);
         if ((buttons & 1) != 0)
         {
+            lock(yellowLed);
             setPinValue(YELLOW_LED, !getPinValue(YELLOW_LED));
+            unlock(yellowLed);
             setPinValue(RED_LED, 1);
         }
         if ((buttons & 2) != 0)
@@ -1212,11 +3321,11 @@ void readKeys()
         }
         if ((buttons & 8) != 0)
         {
-            stopThread(flash4Hz);
+            stopThread(getPid("flash4hz"));
         }
         if ((buttons & 16) != 0)
         {
-            setThreadPriority(lengthyFn, 4);
+            setThreadPriority(getPid("lengthyfn"), 4);
         }
         yield();
     }
@@ -1227,7 +3336,7 @@ void debounce()
     uint8_t count;
     while(true)
     {
-        wait(keyPressed);
+        waitEvents(keyEvents, KEY_PRESSED, EVENT_CLEAR, WAIT_FOREVER);
         count = 10;
         while (count != 0)
         {
@@ -1237,7 +3346,7 @@ void debounce()
             else
                 count = 10;
         }
-        post(keyReleased);
+        postEvents(keyEvents, KEY_RELEASED);
     }
 }
 
@@ -1265,15 +3374,34 @@ void errant()
     }
 }
 
+// Gives up on resource after 2 s, lengthyfn can hold it longer than that
 void important()
 {
     while(true)
     {
-        wait(resource);
+        if(lockTimeout(resource, 2000) != WAIT_OK)
+            continue;
         setPinValue(BLUE_LED, 1);
         sleep(1000);
         setPinValue(BLUE_LED, 0);
-        post(resource);
+        unlock(resource);
+    }
+}
+
+// Partner of the futex command, takes and gives back pingPong in turn with the shell
+#define PING_PONG_ROUNDS 32
+void pong()
+{
+    uint8_t i;
+    while(true)
+    {
+        wait(pongGo);
+        for(i = 0; i < PING_PONG_ROUNDS; i++)
+        {
+            wait(pingPong);
+            post(pingPong);
+            yield();
+        }
     }
 }
 
@@ -1296,7 +3424,7 @@ void shell()
         else if(isCommand(&data, "ps" , 0))
         {
             uint32_t totalCpu = 10000;
-            putsUart0("Name\t\t\tPID\t\t\tPriority\t\t\tState\t\t\tCPU%%\n");
+            putsUart0("Name\t\t\tPID\t\t\tPriority\t\t\tBase\t\t\tState\t\t\tCPU%%\t\t\tDeadline\t\t\tLateness\t\t\tMisses\t\t\tBudget(us)\t\t\tUsed(us)\t\t\tThrottled\t\t\tTickets\t\t\tClass\t\t\tVRuntime(ms)\n");
             while(!ok)
             {
                 ok = getData(SVC_PS, &data);
@@ -1304,6 +3432,10 @@ void shell()
                 putsUart0("\t\t\t");
                 putiUart0(data.value);
                 putsUart0("\t\t\t");
+                putiUart0(data.priority);
+                putsUart0("\t\t\t");
+                putiUart0(data.basePriority);
+                putsUart0("\t\t\t");
                 switch(data.savedIndex / 100)
                 {
                     case STATE_INVALID:
@@ -1321,19 +3453,62 @@ void shell()
                     case STATE_UNRUN:
                         putsUart0("STATE_UNRUN");
                         break;
+                    case STATE_SUSPENDED:
+                        putsUart0("STATE_SUSPENDED");
+                        break;
                 }
                 putsUart0("\t\t\t");
                 putpUart0(data.time);
+                putsUart0("\t\t\t");
+                putiUart0(data.deadline);
+                putsUart0("\t\t\t");
+                if(data.lateness < 0)
+                {
+                    putcUart0('-');
+                    putiUart0(-data.lateness);
+                }
+                else
+                    putiUart0(data.lateness);
+                putsUart0("\t\t\t");
+                putiUart0(data.misses);
+                putsUart0("\t\t\t");
+                if(data.budget)
+                {
+                    putiUart0(data.budget);
+                    putsUart0("\t\t\t");
+                    putiUart0(data.budgetUsed);
+                }
+                else
+                    putsUart0("-\t\t\t-");
+                putsUart0("\t\t\t");
+                putiUart0(data.throttles);
+                putsUart0("\t\t\t");
+                putiUart0(data.tickets);
+                putsUart0(data.schedClass == CLASS_RT ? "\t\t\tRT\t\t\t" : "\t\t\tFAIR\t\t\t");
+                putiUart0(data.vruntime);
                 putcUart0('\n');
                 totalCpu -= data.time;
             }
             putsUart0("Kernel:\t\t\t\t\t\t\t\t\t\t\t");
             putpUart0(totalCpu);
             putcUart0('\n');
+            data.savedIndex = 0;
+            ok = false;
+            while(!ok)
+            {
+                ok = getData(SVC_STATS, &data);
+                putsUart0(data.shellOutput);
+                putsUart0(":\t\t\t");
+                if(data.percent)
+                    putpUart0(data.value);
+                else
+                    putiUart0(data.value);
+                putcUart0('\n');
+            }
         }
         else if(isCommand(&data, "ipcs" , 0))
         {
-            putsUart0("Name\t\t\tCount\t\t\tFirst in Queue\n");
+            putsUart0("Name\t\t\tCount\t\t\tFirst in Queue\t\t\tOwner\t\t\tPriority\t\t\tCeiling\n");
             while(!ok)
             {
                 ok = getData(SVC_IPCS, &data);
@@ -1341,6 +3516,38 @@ void shell()
                 putcUart0('\n');
             }
         }
+        else if(isCommand(&data, "futex" , 0))
+        {
+            // Same ping-pong through the kernel calls, then through the user mode fast path
+            uint32_t cycles[2] = {0, 0};
+            uint32_t start;
+            uint8_t path, i;
+            for(path = 0; path < 2; path++)
+            {
+                post(pongGo);
+                for(i = 0; i < PING_PONG_ROUNDS; i++)
+                {
+                    start = WTIMER0_TAV_R;
+                    if(path == 0)
+                    {
+                        semWait(pingPong);
+                        semPost(pingPong);
+                    }
+                    else
+                    {
+                        wait(pingPong);
+                        post(pingPong);
+                    }
+                    cycles[path] += WTIMER0_TAV_R - start;
+                    yield();
+                }
+            }
+            putsUart0("Uncontended wait + post (cycles)\nSVC:\t\t\t");
+            putiUart0(cycles[0] / PING_PONG_ROUNDS);
+            putsUart0("\nFast path:\t\t\t");
+            putiUart0(cycles[1] / PING_PONG_ROUNDS);
+            putcUart0('\n');
+        }
         else if(isCommand(&data, "kill" , 1))
         {
             if(!isFieldInteger(&data, 1))
@@ -1358,6 +3565,122 @@ void shell()
             else
                 putsUart0("Invalid PID\n");
         }
+        else if(isCommand(&data, "quantum" , 2))
+        {
+            if(!isFieldInteger(&data, 1) || !isFieldInteger(&data, 2))
+            {
+                putsUart0("Invalid command: quantum PID TICKS\n");
+                continue;
+            }
+            if(setThreadQuantum(getFieldInteger(&data, 1), getFieldInteger(&data, 2)))
+            {
+                putsUart0("Quantum of ");
+                putsUart0(getFieldString(&data, 1));
+                putsUart0(" set to ");
+                putsUart0(getFieldString(&data, 2));
+                putsUart0(" ticks\n");
+            }
+            else
+                putsUart0("Invalid PID or quantum\n");
+        }
+        else if(isCommand(&data, "class" , 2))
+        {
+            bool ok = isFieldInteger(&data, 1);
+            if(ok && stringCompare(getFieldString(&data, 2), "rt"))
+                ok = setThreadClass(getFieldInteger(&data, 1), CLASS_RT);
+            else if(ok && stringCompare(getFieldString(&data, 2), "fair"))
+                ok = setThreadClass(getFieldInteger(&data, 1), CLASS_FAIR);
+            else
+            {
+                putsUart0("Invalid command: class PID RT|FAIR\n");
+                continue;
+            }
+            if(ok)
+                putsUart0("Class set\n");
+            else
+                putsUart0("Invalid PID\n");
+        }
+        else if(isCommand(&data, "share" , 2))
+        {
+            if(!isFieldInteger(&data, 1) || !isFieldInteger(&data, 2))
+            {
+                putsUart0("Invalid command: share PID TICKETS\n");
+                continue;
+            }
+            if(setThreadShare(getFieldInteger(&data, 1), getFieldInteger(&data, 2)))
+            {
+                putsUart0("Tickets of ");
+                putsUart0(getFieldString(&data, 1));
+                putsUart0(" set to ");
+                putsUart0(getFieldString(&data, 2));
+                putcUart0('\n');
+            }
+            else
+                putsUart0("Invalid PID or tickets\n");
+        }
+        else if(isCommand(&data, "semtest" , 0))
+        {
+            // Creates, takes and deletes a scratch semaphore, then tries its stale handle
+            const char *results[] = {"ok", "timeout", "invalid"};
+            uint32_t sem = semCreate("scratch", 1);
+            uint32_t reused;
+            if(sem == NO_SEM)
+            {
+                putsUart0("Semaphore table full\n");
+                continue;
+            }
+            putsUart0("Created\t\t\t");
+            putxUart0(sem);
+            putsUart0("\nWait:\t\t\t");
+            putsUart0((char *)results[waitTimeout(sem, 0)]);
+            post(sem);
+            semDelete(sem);
+            putsUart0("\nWait after delete:\t\t\t");
+            putsUart0((char *)results[waitTimeout(sem, 0)]);
+            reused = semCreate("scratch", 0);
+            putsUart0("\nRecreated\t\t\t");
+            putxUart0(reused);
+            putsUart0("\nDelete by old handle:\t\t\t");
+            putsUart0(semDelete(sem) ? "accepted" : "rejected");
+            putcUart0('\n');
+            semDelete(reused);
+        }
+        else if(isCommand(&data, "budget" , 3))
+        {
+            if(!isFieldInteger(&data, 1) || !isFieldInteger(&data, 2) || !isFieldInteger(&data, 3))
+            {
+                putsUart0("Invalid command: budget PID MICROSECONDS PERIOD\n");
+                continue;
+            }
+            if(setThreadBudget(getFieldInteger(&data, 1), getFieldInteger(&data, 2), getFieldInteger(&data, 3)))
+                putsUart0("Budget set\n");
+            else
+                putsUart0("Invalid PID or budget\n");
+        }
+        else if(isCommand(&data, "bench" , 0))
+        {
+            // The SVCs are timed here, the dummies of the step are in place until the next one
+            uint32_t start;
+            putsUart0("Ready\t\t\tScheduler\t\t\tsetThreadQuantum\t\t\tgetPid (cycles)\n");
+            data.savedIndex = 0;
+            while(!getData(SVC_BENCH, &data))
+            {
+                start = WTIMER0_TAV_R;
+                setThreadQuantum(data.benchPid, DEFAULT_QUANTUM);
+                data.benchCycles[1] = WTIMER0_TAV_R - start;
+                start = WTIMER0_TAV_R;
+                getPid(BENCH_NAME);
+                data.benchCycles[2] = WTIMER0_TAV_R - start;
+                putiUart0(data.value);
+                putsUart0("\t\t\t");
+                putiUart0(data.benchCycles[0]);
+                putsUart0("\t\t\t");
+                putiUart0(data.benchCycles[1]);
+                putsUart0("\t\t\t");
+                putiUart0(data.benchCycles[2]);
+                putcUart0('\n');
+            }
+        }
         else if(isCommand(&data, "pmap" , 1))
         {
             if(!isFieldInteger(&data, 1))
@@ -1409,22 +3732,134 @@ void shell()
         {
             if(!isFieldString(&data, 1))
             {
-                putsUart0("Invalid command: sched PRIO|RR\n");
+                putsUart0("Invalid command: sched PRIO|RR|EDF|MLFQ|STRIDE|CLASS\n");
                 continue;
             }
 
             if(stringCompare(getFieldString(&data, 1), "prio"))
             {
-                data.value = 1;
+                data.value = SCHED_PRIO;
                 getData(SVC_PRIORITY, &data);
                 putsUart0("Priority scheduling enabled\n");
             }
             else if(stringCompare(getFieldString(&data, 1), "rr"))
             {
-                data.value = 0;
+                data.value = SCHED_RR;
                 getData(SVC_PRIORITY, &data);
                 putsUart0("Priority scheduling disabled\n");
             }
+            else if(stringCompare(getFieldString(&data, 1), "edf"))
+            {
+                data.value = SCHED_EDF;
+                getData(SVC_PRIORITY, &data);
+                putsUart0("Earliest deadline first scheduling enabled\n");
+            }
+            else if(stringCompare(getFieldString(&data, 1), "mlfq"))
+            {
+                data.value = SCHED_MLFQ;
+                getData(SVC_PRIORITY, &data);
+                putsUart0("Multi-level feedback queue scheduling enabled\n");
+            }
+            else if(stringCompare(getFieldString(&data, 1), "stride"))
+            {
+                data.value = SCHED_STRIDE;
+                getData(SVC_PRIORITY, &data);
+                putsUart0("Stride scheduling enabled\n");
+            }
+            else if(stringCompare(getFieldString(&data, 1), "class"))
+            {
+                data.value = SCHED_CLASS;
+                getData(SVC_PRIORITY, &data);
+                putsUart0("RT and fair scheduling classes enabled\n");
+            }
+            else
+                putsUart0("Invalid command: sched PRIO|RR|EDF|MLFQ|STRIDE|CLASS\n");
+        }
+        else if(isCommand(&data, "aging" , 1))
+        {
+            if(stringCompare(getFieldString(&data, 1), "off"))
+            {
+                data.value = 0;
+                getData(SVC_AGING, &data);
+                putsUart0("Aging disabled\n");
+            }
+            else if(isFieldInteger(&data, 1) && getFieldInteger(&data, 1) > 0)
+            {
+                data.value = getFieldInteger(&data, 1);
+                getData(SVC_AGING, &data);
+                putsUart0("Ready tasks gain a priority level every ");
+                putsUart0(getFieldString(&data, 1));
+                putsUart0(" ticks\n");
+            }
+            else
+                putsUart0("Invalid command: aging TICKS|OFF\n");
+        }
+        else if(isCommand(&data, "crit" , 0) && data.fieldCount != 1)
+        {
+            // Takes no arguments to list, or all four to set
+            uint8_t level = data.fieldCount == 5 && stringCompare(getFieldString(&data, 2), "hi") ? CRIT_HI : CRIT_LO;
+            if(data.fieldCount != 5 || !isFieldInteger(&data, 1) || !isFieldInteger(&data, 3) || !isFieldInteger(&data, 4)
+                    || (level == CRIT_LO && !stringCompare(getFieldString(&data, 2), "lo")))
+            {
+                putsUart0("Invalid command: crit [PID LO|HI LO_BUDGET HI_BUDGET]\n");
+                continue;
+            }
+            if(setThreadCriticality(getFieldInteger(&data, 1), level, getFieldInteger(&data, 3), getFieldInteger(&data, 4)))
+                putsUart0("Criticality set\n");
+            else
+                putsUart0("Invalid PID\n");
+        }
+        else if(isCommand(&data, "crit" , 0))
+        {
+            data.savedIndex = 0;
+            while(!ok)
+            {
+                ok = getData(SVC_CRIT, &data);
+                putsUart0(data.shellOutput);
+                if(data.savedIndex != CRIT_STAT_MODE + 1)
+                {
+                    putsUart0(":\t\t\t");
+                    putiUart0(data.value);
+                }
+                putcUart0('\n');
+            }
+        }
+        else if(isCommand(&data, "cyclic" , 1))
+        {
+            if(stringCompare(getFieldString(&data, 1), "on"))
+            {
+                data.value = 1;
+                getData(SVC_CYCLIC, &data);
+                putsUart0("Cyclic executive started\n");
+            }
+            else if(stringCompare(getFieldString(&data, 1), "off"))
+            {
+                data.value = 0;
+                getData(SVC_CYCLIC, &data);
+                putsUart0("Cyclic executive stopped\n");
+            }
+            else
+                putsUart0("Invalid command: cyclic ON|OFF\n");
+        }
+        else if(isCommand(&data, "tick" , 1))
+        {
+            if(!isFieldString(&data, 1))
+            {
+                putsUart0("Invalid command: tick ON|OFF\n");
+                continue;
+            }
+            if(stringCompare(getFieldString(&data, 1), "on"))
+            {
+                data.value = 0;
+                getData(SVC_TICKLESS, &data);
+                putsUart0("Periodic tick enabled\n");
+            }
+            else if(stringCompare(getFieldString(&data, 1), "off"))
+            {
+                data.value = 1;
+                getData(SVC_TICKLESS, &data);
+                putsUart0("Tickless mode enabled\n");
+            }
         }
         else if(isCommand(&data, "pidof" , 1))
         {
@@ -1465,14 +3900,32 @@ void shell()
         {
             putsUart0("ps: The PID id, process (actually thread) name, and  of CPU time should be stored at a minimum.\n\n"
                       "ipcs: Displays semaphore usage.\n\n"
+                      "futex: Times an uncontended semaphore ping-pong with the pong task through the kernel and the fast path.\n\n"
+                      "semtest: Creates and deletes a semaphore at run time and shows that its old handle is rejected.\n\n"
                       "kill <PID>: This command allows a task to be killed, by referencing the process ID.\n\n");
             putsUart0("reboot: The command restarts the processor.\n\n"
                       "pidof <Process_Name>: Returns the PID of a task.\n\n"
                       "run <Process_Name>: Starts a task running in the background if not already running. Only one instance of\n"
                       "a named task is allowed. \n\n");
+            putsUart0("bench: Times the scheduler, and setThreadQuantum() and getPid() on a dummy task, while filling the free TCBs with dummies.\n\n");
             putsUart0("pmap PID: Displays memory usage by the process (thread) with the matching PID.\n\n"
                       "preempt ON|OFF: Turns preemption on or off. The default is preemption on.\n\n"
-                      "sched PRIO|RR: Selectes priority or round-robin scheduling. The default is priority scheduling.\n\n");
+                      "sched PRIO|RR|EDF|MLFQ|STRIDE|CLASS: Selectes priority, round-robin, earliest deadline first, multi-level feedback\n"
+                      "queue, stride or class scheduling. Under EDF, tasks without a deadline run by priority when no deadline task is ready. Under MLFQ,\n"
+                      "tasks drop a level when they use a whole slice and climb one when they block early. Under STRIDE, tasks of the\n"
+                      "top ready priority share the CPU in proportion to their tickets. Under CLASS, RT tasks run by priority and\n"
+                      "fair tasks by least vruntime when no RT task is ready. The default is priority scheduling.\n\n");
+            putsUart0("quantum PID TICKS: Sets how many ticks a task runs before others of its priority get a turn.\n\n");
+            putsUart0("class PID RT|FAIR: Moves a task to the real-time or the fair class.\n\n");
+            putsUart0("share PID TICKETS: Sets the tickets of a task, 1 to 1000, used by stride scheduling.\n\n");
+            putsUart0("budget PID MICROSECONDS PERIOD: Limits a task to MICROSECONDS of CPU time every PERIOD ticks, 0 removes the limit.\n\n");
+            putsUart0("aging TICKS|OFF: Raises tasks left ready for TICKS by one priority level until they run, never above priority 1.\n\n");
+            putsUart0("crit [PID LO|HI LO_BUDGET HI_BUDGET]: Shows the criticality mode and how often and how long the system was in\n"
+                      "HI mode, or sets the criticality of a task and its per-job budgets in microseconds. A HI task exceeding its\n"
+                      "LO budget suspends the LO tasks until the system is idle again.\n\n");
+            putsUart0("cyclic ON|OFF: Starts or stops releasing the slot table tasks at fixed ticks of the major frame.\n\n");
+            putsUart0("tick ON|OFF: Turns the periodic 1 ms tick on or off. With the tick off the kernel programs SysTick\n"
+                      "for the next event and idles in WFI. The default is tick on.\n\n");
         }
         data.value = 0;
         data.savedIndex= 0;
@@ -1488,6 +3941,7 @@ void shell()
 int main(void)
 {
     bool ok;
+    uint8_t i;
 
     // Initialize hardware
     initHw();
@@ -1505,24 +3959,35 @@ int main(void)
     waitMicrosecond(250000);
 
     // Initialize semaphores
-    createSemaphore(keyPressed, 1, "keypressed");
-    createSemaphore(keyReleased, 0, "keyreleased");
-    createSemaphore(flashReq, 5, "flashreq");
-    createSemaphore(resource, 1, "resource");
+    flashReq = createSemaphore("flashreq", 5);
+    pingPong = createSemaphore("pingpong", 1);
+    pongGo = createSemaphore("ponggo", 0);
+    createMutex(resource, "resource");
+    createCeilingMutex(yellowLed, "yellowled", 2); // shared by oneshot and readkeys
+    createEventGroup(keyEvents, KEY_PRESSED, "keyevents");
 
     // Add required idle process at lowest priority
-    ok =  createThread(idle, "idle", 7, 1024);
+    ok =  createThread(idle, "idle", 7, 1024, 0, 0, 1, CLASS_FAIR);
 
     // Add other processes
-    ok &= createThread(lengthyFn, "lengthyfn", 6, 1024);
-    ok &= createThread(flash4Hz, "flash4hz", 4, 1024);
-    ok &= createThread(oneshot, "oneshot", 2, 1024);
-    ok &= createThread(readKeys, "readkeys", 6, 1024);
-    ok &= createThread(debounce, "debounce", 6, 1024);
-    ok &= createThread(important, "important", 0, 1024);
-    ok &= createThread(uncooperative, "uncoop", 6, 1024);
-    ok &= createThread(errant, "errant", 6, 1024);
-    ok &= createThread(shell, "shell", 6, 2048);
+    ok &= createThread(lengthyFn, "lengthyfn", 6, 1024, 0, 0, 10, CLASS_FAIR);
+    ok &= createPeriodicThread(flash4Hz, "flash4hz", 4, 1024, 125, 125);
+    ok &= createThread(flashCyclic, "flashcyclic", 4, 1024, 0, 0, 1, CLASS_RT);
+    ok &= createThread(oneshot, "oneshot", 2, 1024, 0, 10, 1, CLASS_RT);
+    ok &= createThread(readKeys, "readkeys", 6, 1024, 0, 0, 1, CLASS_FAIR);
+    ok &= createThread(debounce, "debounce", 6, 1024, 0, 0, 1, CLASS_FAIR);
+    ok &= createThread(important, "important", 0, 1024, 0, 5, 1, CLASS_RT);
+    ok &= createThread(uncooperative, "uncoop", 6, 1024, 0, 0, 1, CLASS_FAIR);
+    ok &= createThread(errant, "errant", 6, 1024, 0, 0, 1, CLASS_FAIR);
+    ok &= createThread(pong, "pong", 6, 1024, 0, 0, 1, CLASS_FAIR);
+    ok &= createThread(shell, "shell", 6, 2048, 0, 0, 1, CLASS_FAIR);
+    ok &= setBudget(taskPid("uncoop"), 2000, 10); // 20% of the CPU at most
+    ok &= setCriticality(taskPid("important"), CRIT_HI, 500, 2000);
+    ok &= setCriticality(taskPid("oneshot"), CRIT_HI, 500, 2000);
+
+    // Static slot table for the cyclic executive, flashcyclic at the start of each minor frame
+    for(i = 0; i < MINOR_FRAMES; i++)
+        ok &= createSlot("flashcyclic", i, 0);
 
     // Start up RTOS
     if (ok)
@@ -8,14 +8,15 @@
 // Target uC:       TM4C123GH6PM
 // System Clock:    40 MHz
 
-#ifndef WAIT_H_
-#define WAIT_H_
+#ifndef RTOSASM_H_
+#define RTOSASM_H_
 
 //-----------------------------------------------------------------------------
 // Subroutines
 //-----------------------------------------------------------------------------
 
 #include <stdint.h>
+#include <stdbool.h>
 
 extern void setASP(void);
 extern void setPSP(uint32_t *stack);
@@ -23,9 +24,11 @@ extern uint32_t *getPSP(void);
 extern uint32_t *getMSP(void);
 extern void pushPSPRegisterOffset(uint32_t offset, uint32_t data);
 extern void removePriv(void);
-extern void pushToPSPStack(void);
-extern void popPSPStack(void);
 extern void pushDummyPSPStack(uint32_t xPSR, uint32_t pfn);
+extern uint32_t countLeadingZeros(uint32_t value);
+extern void pendSvIsr(void);
+extern bool semTryWait(uint32_t *count, uint32_t sem);
+extern bool semTryPost(uint32_t *count, uint32_t sem);
 
 
 #endif
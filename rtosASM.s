@@ -28,9 +28,12 @@
 	.def getMSP
 	.def pushPSPRegisterOffset
 	.def removePriv
-	.def pushToPSPStack
-	.def popPSPStack
 	.def pushDummyPSPStack
+	.def countLeadingZeros
+	.def pendSvIsr
+	.def semTryWait
+	.def semTryPost
+	.ref pendSvSwitch
     
 
 ;-----------------------------------------------------------------------------
@@ -41,6 +44,7 @@
 .const
 
 RETURN_TO_HANDLER_NF       .field   0xFFFFFFFD
+WTIMER0_TAV                .field   0x40036050
 
 
 ;-----------------------------------------------------------------------------
@@ -82,48 +86,6 @@ removePriv:
             ISB
             BX   LR
 
-pushToPSPStack:
-            MRS  R0,  PSP
-            SUB  R0,  R0,  #4
-            STR  R11, [R0]
-            SUB  R0,  R0,  #4
-            STR  R10, [R0]
-            SUB  R0,  R0,  #4
-            STR  R9,  [R0]
-            SUB  R0,  R0,  #4
-            STR  R8,  [R0]
-            SUB  R0,  R0,  #4
-            STR  R7,  [R0]
-            SUB  R0,  R0,  #4
-            STR  R6,  [R0]
-            SUB  R0,  R0,  #4
-            STR  R5,  [R0]
-            SUB  R0,  R0,  #4
-            STR  R4,  [R0]
-            MSR  PSP, R0
-            BX   LR
-
-popPSPStack:
-            MRS  R0,  PSP
-            LDR  R4,  [R0]
-            ADD  R0,  R0,  #4
-            LDR  R5,  [R0]
-            ADD  R0,  R0,  #4
-            LDR  R6,  [R0]
-            ADD  R0,  R0,  #4
-            LDR  R7,  [R0]
-            ADD  R0,  R0,  #4
-            LDR  R8,  [R0]
-            ADD  R0,  R0,  #4
-            LDR  R9,  [R0]
-            ADD  R0,  R0,  #4
-            LDR  R10, [R0]
-            ADD  R0,  R0,  #4
-            LDR  R11, [R0]
-            ADD  R0,  R0,  #4
-            MSR  PSP, R0
-            BX   LR
-
 pushDummyPSPStack:
             MRS  R2,  PSP
             SUB  R2,  R2,  #4
@@ -139,7 +101,76 @@ loop:       SUB  R2,  R2,  #4
             SUB  R1,  R1,  #1
             CBZ  R1,  exit
             B    loop
-exit:    	MSR  PSP, R2
+exit:       SUB  R2,  R2,  #4
+            STR  R3,  [R2]              ; EXC_RETURN without FPU context, restored by pendSvIsr
+            SUB  R2,  R2,  #32          ; R4 - R11, restored by pendSvIsr
+            MSR  PSP, R2
+            BX   LR
+
+countLeadingZeros:
+            CLZ  R0,  R0
+            BX   LR
+
+; R4 - R11 are stored before any C code can touch them and restored after the
+; scheduler picked the next task, pendSvSwitch returns the stack to restore from
+; EXC_RETURN is kept with them. Its bit 4 is clear when the task has used the FPU,
+; then S16 - S31 are saved too, which also completes the lazy save of S0 - S15
+pendSvIsr:
+            LDR  R1,  WTIMER0_TAV
+            LDR  R1,  [R1]              ; Start of the switch for pendSvSwitch
+            MRS  R0,  PSP
+            TST  LR,  #0x10
+            IT   EQ
+            VSTMDBEQ R0!, {S16-S31}
+            STMDB R0!, {R4-R11, LR}
+            BL   pendSvSwitch
+            LDMIA R0!, {R4-R11, LR}
+            TST  LR,  #0x10
+            IT   EQ
+            VLDMIAEQ R0!, {S16-S31}
+            MSR  PSP, R0
+            BX   LR                     ; Exception return, FPCA follows bit 4
+
+; User mode fast paths of wait() and post() on the semaphore count at R0, return 1 when
+; done and 0 when the kernel must block the caller or wake a waiter. The word after the
+; count holds the handle of the live semaphore, a mismatch with R1 goes to the kernel too.
+; Exception entry and return clear the exclusive monitor, so the STREX fails and retries
+; if anything ran between
+semTryWait:
+            LDREX R2, [R0]
+            LDR  R3,  [R0, #4]
+            CMP  R3,  R1
+            BNE  waitKernel             ; Deleted semaphore
+            CBZ  R2,  waitKernel        ; Nothing to take
+            TST  R2,  #0x80000000
+            BNE  waitKernel             ; SEM_WAITERS, queue behind them
+            SUB  R2,  R2,  #1
+            STREX R3, R2, [R0]
+            CMP  R3,  #0
+            BNE  semTryWait
+            MOV  R0,  #1
+            BX   LR
+waitKernel: CLREX
+            MOV  R0,  #0
+            BX   LR
+
+semTryPost:
+            LDREX R2, [R0]
+            LDR  R3,  [R0, #4]
+            CMP  R3,  R1
+            BNE  postKernel             ; Deleted semaphore
+            TST  R2,  #0x80000000
+            BNE  postKernel             ; SEM_WAITERS, the kernel wakes one
+            ADD  R2,  R2,  #1
+            TST  R2,  #0x80000000
+            BNE  postKernel             ; Count full, the kernel drops the post
+            STREX R3, R2, [R0]
+            CMP  R3,  #0
+            BNE  semTryPost
+            MOV  R0,  #1
+            BX   LR
+postKernel: CLREX
+            MOV  R0,  #0
             BX   LR
 .end
 
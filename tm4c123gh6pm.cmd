@@ -11,7 +11,8 @@
 MEMORY
 {
     FLASH (RX) : origin = 0x00000000, length = 0x00040000
-    SRAM (RWX) : origin = 0x20000000, length = 0x00001400
+    SRAM (RWX) : origin = 0x20000000, length = 0x00001C00
+    SHARED (RW) : origin = 0x20001C00, length = 0x00000400
 }
 
 /* The following command line options are set as part of the CCS project.    */
@@ -40,6 +41,7 @@ SECTIONS
     .bss    :   > SRAM
     .sysmem :   > SRAM
     .stack  :   > SRAM
+    .shared :   > SHARED
 }
 
 __STACK_TOP = __stack + 512;
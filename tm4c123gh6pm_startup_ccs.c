@@ -48,6 +48,7 @@ extern void mpuFaultIsr(void);
 extern void pendSvIsr(void);
 extern void svCallIsr(void);
 extern void systickIsr(void);
+extern void uart0Isr(void);
 
 //*****************************************************************************
 //
@@ -95,7 +96,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port C
     IntDefaultHandler,                      // GPIO Port D
     IntDefaultHandler,                      // GPIO Port E
-    IntDefaultHandler,                      // UART0 Rx and Tx
+    uart0Isr,                               // UART0 Rx and Tx
     IntDefaultHandler,                      // UART1 Rx and Tx
     IntDefaultHandler,                      // SSI0 Rx and Tx
     IntDefaultHandler,                      // I2C0 Master and Slave
@@ -185,7 +185,7 @@ char getcUart0(void)
 {
 //    while (UART0_FR_R & UART_FR_RXFE);               // wait if uart0 rx fifo empty
     while(UART0_FR_R & UART_FR_RXFE)                       // if Uart0 rx fifo is empty --> yield
-        __asm(" SVC #2");
+        __asm(" SVC #42");                               // SVC_INPUT_WAIT, blocks until uart0 receives
     return UART0_DR_R & 0xFF;                        // get character from fifo
 }
 
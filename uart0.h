@@ -36,7 +36,21 @@ typedef struct _USER_DATA
     char fieldType[MAX_FIELDS]; //n = number a = alpha f = float
     uint32_t value;
     uint32_t time;
+    uint8_t priority;           // effective priority
+    uint8_t basePriority;
     uint16_t savedIndex;
+    bool percent;               // value is in hundredths of a percent
+    uint32_t deadline;
+    int32_t lateness;
+    uint32_t misses;
+    uint32_t budget;            // microseconds per budget period
+    uint32_t budgetUsed;
+    uint32_t throttles;
+    uint16_t tickets;
+    uint8_t schedClass;
+    uint32_t vruntime;          // milliseconds
+    uint32_t benchCycles[3];    // scheduler, setThreadQuantum(), getPid()
+    uint32_t benchPid;          // dummy the shell passes to setThreadQuantum()
 } USER_DATA;
 
 //-----------------------------------------------------------------------------